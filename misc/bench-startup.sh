@@ -0,0 +1,39 @@
+#!/bin/bash
+# Time how long uzbl-core takes to load a large configuration and exit.
+#
+# Usage: bench-startup.sh <uzbl-core> [lines] [runs]
+#
+# The configuration is split over a number of included files, much like a
+# setup with generated bind files. It needs a display, like any other run of
+# uzbl-core.
+
+readonly core="${1:-./uzbl-core}"
+readonly lines="${2:-20000}"
+readonly runs="${3:-5}"
+readonly includes=10
+
+dir="$( mktemp -d )"
+trap 'rm -rf "$dir"' EXIT
+
+i=0
+while [ "$i" -lt "$includes" ]; do
+    awk -v n="$(( lines / includes ))" -v f="$i" 'BEGIN {
+        for (j = 0; j < n; ++j) {
+            if (j % 4 == 0)
+                print "# generated binding " f "." j
+            else
+                print "    set bench_" f "_" j " = value " j "   "
+        }
+    }' > "$dir/include-$i"
+    echo "include $dir/include-$i" >> "$dir/config"
+    i=$(( i + 1 ))
+done
+echo "exit" >> "$dir/config"
+
+echo "Loading $lines lines from $includes includes, $runs runs:"
+
+run=0
+while [ "$run" -lt "$runs" ]; do
+    time "$core" --config "$dir/config" >/dev/null
+    run=$(( run + 1 ))
+done
@@ -5,6 +5,7 @@
       description='Uzbl event daemon',
       url='http://uzbl.org',
       packages=['uzbl', 'uzbl.plugins'],
+      install_requires=['six'],
       entry_points={
           'console_scripts': [
              'uzbl-event-manager = uzbl.event_manager:main'
@@ -11,6 +11,14 @@
 
 static GString *
 append_escaped (GString *dest, const gchar *src);
+static void
+append_frame_u32 (GByteArray *frame, guint32 val);
+static void
+append_frame_u64 (GByteArray *frame, guint64 val);
+static void
+append_frame_string (GByteArray *frame, const gchar *str, gsize len);
+static GBytes *
+finish_frame (GByteArray *frame);
 
 void
 uzbl_comm_string_append_double (GString *buf, double val)
@@ -86,8 +94,136 @@ uzbl_comm_vformat (const gchar *directive, const gchar *function, va_list vargs)
     return message;
 }
 
+GBytes *
+uzbl_comm_vformat_frame (const gchar *directive, const gchar *function, va_list vargs)
+{
+    GByteArray *frame = g_byte_array_sized_new (512);
+    guint count = 0;
+    guint count_offset;
+    guint32 count_be;
+    int next;
+
+    /* Filled in by finish_frame. */
+    append_frame_u32 (frame, 0);
+    append_frame_string (frame, directive, strlen (directive));
+    append_frame_string (frame, uzbl.state.instance_name, strlen (uzbl.state.instance_name));
+    append_frame_string (frame, function, strlen (function));
+
+    count_offset = frame->len;
+    append_frame_u32 (frame, 0);
+
+    while ((next = va_arg (vargs, int))) {
+        guint8 type = next;
+        const gchar *str;
+
+        g_byte_array_append (frame, &type, 1);
+        ++count;
+
+        switch (next) {
+        case TYPE_INT:
+            append_frame_u32 (frame, (guint32)va_arg (vargs, int));
+            break;
+        case TYPE_ULL:
+            append_frame_u64 (frame, va_arg (vargs, unsigned long long));
+            break;
+        case TYPE_DOUBLE:
+        {
+            gdouble d = va_arg (vargs, double);
+            guint64 bits;
+
+            memcpy (&bits, &d, sizeof (bits));
+            append_frame_u64 (frame, bits);
+            break;
+        }
+        case TYPE_NAME:
+            str = va_arg (vargs, char *);
+            g_assert (uzbl_variables_is_valid (str));
+            append_frame_string (frame, str, strlen (str));
+            break;
+        case TYPE_STR:
+        case TYPE_FORMATTEDSTR:
+            str = va_arg (vargs, char *);
+            append_frame_string (frame, str, strlen (str));
+            break;
+        case TYPE_STR_ARRAY:
+        {
+            GArray *a = va_arg (vargs, GArray *);
+            guint i;
+
+            append_frame_u32 (frame, a ? a->len : 0);
+            for (i = 0; a && i < a->len; ++i) {
+                str = argv_idx (a, i);
+                append_frame_string (frame, str, strlen (str));
+            }
+            break;
+        }
+        }
+    }
+
+    count_be = GUINT32_TO_BE (count);
+    memcpy (frame->data + count_offset, &count_be, sizeof (count_be));
+
+    return finish_frame (frame);
+}
+
+GBytes *
+uzbl_comm_frame_text (const gchar *text)
+{
+    GByteArray *frame = g_byte_array_new ();
+    gsize len = strlen (text);
+    guint8 type = TYPE_STR;
+
+    /* The frame delimits the message already. */
+    if (len && (text[len - 1] == '\n')) {
+        --len;
+    }
+
+    append_frame_u32 (frame, 0);
+    append_frame_string (frame, "", 0);
+    append_frame_string (frame, "", 0);
+    append_frame_string (frame, "", 0);
+    append_frame_u32 (frame, 1);
+    g_byte_array_append (frame, &type, 1);
+    append_frame_string (frame, text, len);
+
+    return finish_frame (frame);
+}
+
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
+void
+append_frame_u32 (GByteArray *frame, guint32 val)
+{
+    guint32 be = GUINT32_TO_BE (val);
+
+    g_byte_array_append (frame, (const guint8 *)&be, sizeof (be));
+}
+
+void
+append_frame_u64 (GByteArray *frame, guint64 val)
+{
+    guint64 be = GUINT64_TO_BE (val);
+
+    g_byte_array_append (frame, (const guint8 *)&be, sizeof (be));
+}
+
+void
+append_frame_string (GByteArray *frame, const gchar *str, gsize len)
+{
+    append_frame_u32 (frame, len);
+    g_byte_array_append (frame, (const guint8 *)str, len);
+}
+
+GBytes *
+finish_frame (GByteArray *frame)
+{
+    guint32 len = GUINT32_TO_BE (frame->len - sizeof (guint32));
+
+    memcpy (frame->data, &len, sizeof (len));
+
+    return g_byte_array_free_to_bytes (frame);
+}
+
 GString *
 append_escaped (GString *dest, const gchar *src)
 {
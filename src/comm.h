@@ -9,4 +9,23 @@ uzbl_comm_string_append_double (GString *buf, double val);
 GString *
 uzbl_comm_vformat (const gchar *directive, const gchar *function, va_list vargs);
 
+/* Binary framing. A frame is a big-endian 32-bit length followed by the
+ * directive, instance name and function as strings, a 32-bit field count and
+ * the fields. Each field is a UzblType code byte followed by its value:
+ *
+ *   TYPE_INT                       32-bit signed integer
+ *   TYPE_ULL                       64-bit unsigned integer
+ *   TYPE_DOUBLE                    64-bit IEEE 754 double
+ *   TYPE_STR, TYPE_NAME,
+ *   TYPE_FORMATTEDSTR              string
+ *   TYPE_STR_ARRAY                 32-bit count followed by strings
+ *
+ * Strings are a 32-bit length followed by that many bytes (no terminator).
+ * A frame with an empty directive carries a plain text message as its only
+ * field. */
+GBytes *
+uzbl_comm_vformat_frame (const gchar *directive, const gchar *function, va_list vargs);
+GBytes *
+uzbl_comm_frame_text (const gchar *text);
+
 #endif
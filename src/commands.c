@@ -1,6 +1,8 @@
 #include "commands.h"
 
+#include "comm.h"
 #include "events.h"
+#include "filter.h"
 #include "gui.h"
 #include "io.h"
 #include "js.h"
@@ -14,6 +16,7 @@
 #include "uzbl-core.h"
 #include "variables.h"
 
+#include <sys/stat.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -34,8 +37,18 @@
  */
 
 struct _UzblCommands {
-    /* Table of all builtin commands. */
-    GHashTable *table;
+    /* All builtin commands, sorted for name_table_lookup. */
+    GPtrArray *table;
+
+    /* Parsed handler commands, keyed by their expanded text. */
+    GMutex      parse_cache_lock;
+    GHashTable *parse_cache;
+
+    /* Asynchronous spawns which are still running. */
+    GHashTable *spawns;
+
+    /* Long-lived helper processes, keyed by program. */
+    GHashTable *workers;
 
     /* Search variables */
     UzblFindOptions  search_options;
@@ -56,39 +69,85 @@ struct _UzblCommand {
 static const UzblCommand
 builtin_command_table[];
 
+typedef struct {
+    const UzblCommand *info;
+    GArray            *argv;
+} UzblParsedCommand;
+
+typedef struct {
+    GSubprocess   *process;
+    GInputStream  *output_stream;
+    GString       *output;
+    GCancellable  *cancellable;
+    guint          timeout;
+
+    UzblCommandsCallback callback;
+    gpointer             data;
+} UzblSpawn;
+
+/* Cleared when it grows past this many entries. */
+#define UZBL_PARSE_CACHE_SIZE 64
+
 /* =========================== PUBLIC API =========================== */
 
 static void
 init_js_commands_api ();
+static void
+free_parsed_command (gpointer data);
+static void
+handler_changed (UzblVariableId id, gpointer data);
+static void
+cancel_spawn (gpointer data, gpointer user_data);
+static void
+free_worker_pool (gpointer data);
 
 void
 uzbl_commands_init ()
 {
     uzbl.commands = g_malloc (sizeof (UzblCommands));
 
-    uzbl.commands->table = g_hash_table_new (g_str_hash, g_str_equal);
+    uzbl.commands->table = name_table_new (builtin_command_table, sizeof (UzblCommand));
+
+    g_mutex_init (&uzbl.commands->parse_cache_lock);
+    uzbl.commands->parse_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_parsed_command);
+
+    /* Parses of an old handler are of no more use. */
+    uzbl_variables_connect (UZBL_VARIABLE_NAVIGATION_HANDLER, handler_changed, NULL);
+    uzbl_variables_connect (UZBL_VARIABLE_REQUEST_HANDLER, handler_changed, NULL);
+    uzbl_variables_connect (UZBL_VARIABLE_MIME_HANDLER, handler_changed, NULL);
+    uzbl_variables_connect (UZBL_VARIABLE_PERMISSION_HANDLER, handler_changed, NULL);
+    uzbl_variables_connect (UZBL_VARIABLE_DOWNLOAD_HANDLER, handler_changed, NULL);
+    uzbl_variables_connect (UZBL_VARIABLE_FILE_CHOOSER_HANDLER, handler_changed, NULL);
+    uzbl_variables_connect (UZBL_VARIABLE_AUTHENTICATION_HANDLER, handler_changed, NULL);
+
+    uzbl.commands->spawns = g_hash_table_new (g_direct_hash, g_direct_equal);
+    uzbl.commands->workers = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, free_worker_pool);
 
     uzbl.commands->search_options = 0;
     uzbl.commands->search_options_last = 0;
     uzbl.commands->search_forward = FALSE;
     uzbl.commands->search_text = NULL;
 
-    const UzblCommand *cmd = &builtin_command_table[0];
-    while (cmd->name) {
-        g_hash_table_insert (uzbl.commands->table,
-            (gpointer)cmd->name,
-            (gpointer)cmd);
-
-        ++cmd;
-    }
-
     init_js_commands_api ();
 }
 
 void
 uzbl_commands_free ()
 {
-    g_hash_table_destroy (uzbl.commands->table);
+    g_ptr_array_free (uzbl.commands->table, TRUE);
+
+    g_hash_table_destroy (uzbl.commands->parse_cache);
+    g_mutex_clear (&uzbl.commands->parse_cache_lock);
+
+    /* Outstanding spawns fail now; their processes are collected on their
+     * own time. */
+    GList *spawns = g_hash_table_get_keys (uzbl.commands->spawns);
+    g_list_foreach (spawns, cancel_spawn, NULL);
+    g_list_free (spawns);
+    g_hash_table_destroy (uzbl.commands->spawns);
+    g_hash_table_destroy (uzbl.commands->workers);
 
     g_free (uzbl.commands->search_text);
 
@@ -127,10 +186,16 @@ uzbl_commands_send_builtin_event ()
     g_string_free (command_list, TRUE);
 }
 
+static void
+clear_arg (gpointer data);
+
 GArray *
 uzbl_commands_args_new ()
 {
-    return g_array_new (TRUE, TRUE, sizeof (gchar *));
+    GArray *argv = g_array_new (TRUE, TRUE, sizeof (gchar *));
+    g_array_set_clear_func (argv, clear_arg);
+
+    return argv;
 }
 
 void
@@ -147,60 +212,105 @@ uzbl_commands_args_free (GArray *argv)
         return;
     }
 
-    while (argv->len) {
-        g_free (argv_idx (argv, argv->len - 1));
-        g_array_remove_index (argv, argv->len - 1);
-    }
     g_array_free (argv, TRUE);
 }
 
-static void
-parse_command_arguments (const gchar *args, GArray *argv, gboolean split);
+static gchar *
+expand_line (const gchar *cmd);
+static const UzblCommand *
+parse_line (const gchar *line, GArray *argv, GStringChunk *arena);
 
 const UzblCommand *
 uzbl_commands_parse (const gchar *cmd, GArray *argv)
+{
+    gchar *exp_line = expand_line (cmd);
+    if (!exp_line) {
+        return NULL;
+    }
+
+    const UzblCommand *info = parse_line (exp_line, argv, NULL);
+
+    g_free (exp_line);
+
+    return info;
+}
+
+const UzblCommand *
+uzbl_commands_parse_cached (const gchar *cmd, GArray *argv)
 {
     if (!cmd || cmd[0] == '#' || !*cmd) {
         return NULL;
     }
 
-    gchar *exp_line = uzbl_variables_expand (cmd);
-    if (!exp_line || !*exp_line) {
+    /* Without any expansions, the line is its own expansion. */
+    gchar *exp_line = NULL;
+    const gchar *line = cmd;
+
+    if (strchr (cmd, '@')) {
+        line = exp_line = uzbl_variables_expand (cmd);
+    }
+
+    if (!line || !*line) {
         g_free (exp_line);
         return NULL;
     }
 
-    /* Separate the line into the command and its parameters. */
-    gchar **tokens = g_strsplit (exp_line, " ", 2);
+    g_mutex_lock (&uzbl.commands->parse_cache_lock);
 
-    const gchar *command = tokens[0];
-    const gchar *arg_string = tokens[1];
+    UzblParsedCommand *parsed = g_hash_table_lookup (uzbl.commands->parse_cache, line);
 
-    /* Look up the command. */
-    const UzblCommand *info = g_hash_table_lookup (uzbl.commands->table, command);
+    if (!parsed) {
+        GArray *args = uzbl_commands_args_new ();
+        const UzblCommand *info = parse_line (line, args, NULL);
 
-    if (!info) {
-        uzbl_events_send (COMMAND_ERROR, NULL,
-            TYPE_STR, command,
-            NULL);
+        if (!info) {
+            g_mutex_unlock (&uzbl.commands->parse_cache_lock);
+            uzbl_commands_args_free (args);
+            g_free (exp_line);
+            return NULL;
+        }
 
-        g_free (exp_line);
-        g_strfreev (tokens);
+        if (UZBL_PARSE_CACHE_SIZE <= g_hash_table_size (uzbl.commands->parse_cache)) {
+            g_hash_table_remove_all (uzbl.commands->parse_cache);
+        }
 
-        return NULL;
+        parsed = g_malloc (sizeof (UzblParsedCommand));
+        parsed->info = info;
+        parsed->argv = args;
+
+        g_hash_table_insert (uzbl.commands->parse_cache, g_strdup (line), parsed);
     }
 
-    /* Parse the arguments. */
-    if (argv && arg_string) {
-        parse_command_arguments (arg_string, argv, info->split);
+    const UzblCommand *info = parsed->info;
+
+    if (argv) {
+        guint i;
+
+        for (i = 0; i < parsed->argv->len; ++i) {
+            uzbl_commands_args_append (argv, g_strdup (argv_idx (parsed->argv, i)));
+        }
     }
 
+    g_mutex_unlock (&uzbl.commands->parse_cache_lock);
+
     g_free (exp_line);
-    g_strfreev (tokens);
 
     return info;
 }
 
+void
+uzbl_commands_clear_cache ()
+{
+    if (!uzbl.commands) {
+        return;
+    }
+
+    g_mutex_lock (&uzbl.commands->parse_cache_lock);
+    g_hash_table_remove_all (uzbl.commands->parse_cache);
+    g_mutex_unlock (&uzbl.commands->parse_cache_lock);
+}
+
+
 void
 uzbl_commands_run_parsed (const UzblCommand *info, GArray *argv, GString *result)
 {
@@ -227,7 +337,7 @@ void
 uzbl_commands_run_argv (const gchar *cmd, GArray *argv, GString *result)
 {
     /* Look up the command. */
-    const UzblCommand *info = g_hash_table_lookup (uzbl.commands->table, cmd);
+    const UzblCommand *info = name_table_lookup (uzbl.commands->table, cmd);
 
     if (!info) {
         uzbl_events_send (COMMAND_ERROR, NULL,
@@ -242,21 +352,87 @@ uzbl_commands_run_argv (const gchar *cmd, GArray *argv, GString *result)
 
 void
 uzbl_commands_run (const gchar *cmd, GString *result)
+{
+    gchar *exp_line = expand_line (cmd);
+    if (!exp_line) {
+        return;
+    }
+
+    /* The arguments are only needed for the duration of the command, so they
+     * are carved out of a single block sized for the line rather than
+     * allocated one by one. */
+    GStringChunk *arena = g_string_chunk_new (strlen (exp_line) + 1);
+    GArray *argv = g_array_sized_new (TRUE, TRUE, sizeof (gchar *), 8);
+
+    const UzblCommand *info = parse_line (exp_line, argv, arena);
+
+    uzbl_commands_run_parsed (info, argv, result);
+
+    g_array_free (argv, TRUE);
+    g_string_chunk_free (arena);
+    g_free (exp_line);
+}
+
+typedef struct {
+    const UzblCommand    *info;
+    GArray               *argv;
+    UzblCommandsCallback  callback;
+    gpointer              data;
+} UzblAsyncCommand;
+
+static gboolean
+spawn_async (GArray *args, UzblCommandsCallback callback, gpointer data);
+static GArray *
+spawn_args (GArray *argv);
+static GArray *
+spawn_sh_args (GArray *argv);
+static gboolean
+run_async_command (gpointer data);
+
+void
+uzbl_commands_run_async (const gchar *cmd, UzblCommandsCallback callback, gpointer data)
 {
     GArray *argv = uzbl_commands_args_new ();
     const UzblCommand *info = uzbl_commands_parse (cmd, argv);
 
-    uzbl_commands_run_parsed (info, argv, result);
+    if (!info) {
+        uzbl_commands_args_free (argv);
+        callback (NULL, data);
+        return;
+    }
 
-    uzbl_commands_args_free (argv);
+    GArray *args = NULL;
+
+    /* Programs run alongside uzbl instead of in its place. */
+    if (!strcmp (info->name, "spawn_sync")) {
+        args = spawn_args (argv);
+    } else if (!strcmp (info->name, "spawn_sh_sync")) {
+        args = spawn_sh_args (argv);
+    }
+
+    if (args) {
+        uzbl_commands_args_free (argv);
+        spawn_async (args, callback, data);
+        uzbl_commands_args_free (args);
+        return;
+    }
+
+    UzblAsyncCommand *async = g_malloc (sizeof (UzblAsyncCommand));
+
+    async->info = info;
+    async->argv = argv;
+    async->callback = callback;
+    async->data = data;
+
+    g_idle_add (run_async_command, async);
 }
 
-typedef void (*UzblLineCallback) (const gchar *line, gpointer data);
+typedef void (*UzblLineCallback) (gchar *line, gpointer data);
 
 static gboolean
 for_each_line_in_file (const gchar *path, UzblLineCallback callback, gpointer data);
 static void
-parse_command_from_file_cb (const gchar *line, gpointer data);
+parse_command_from_file_cb (gchar *line, gpointer data);
 
 void
 uzbl_commands_load_file (const gchar *path)
@@ -273,6 +449,118 @@ uzbl_commands_load_file (const gchar *path)
 
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
+gboolean
+run_async_command (gpointer data)
+{
+    UzblAsyncCommand *async = (UzblAsyncCommand *)data;
+    GString *result = g_string_new ("");
+
+    uzbl_commands_run_parsed (async->info, async->argv, result);
+
+    async->callback (result, async->data);
+
+    g_string_free (result, TRUE);
+    uzbl_commands_args_free (async->argv);
+    g_free (async);
+
+    return FALSE;
+}
+
+void
+cancel_spawn (gpointer data, gpointer user_data)
+{
+    UZBL_UNUSED (user_data);
+
+    UzblSpawn *spawn = (UzblSpawn *)data;
+
+    if (spawn->timeout) {
+        g_source_remove (spawn->timeout);
+        spawn->timeout = 0;
+    }
+
+    g_subprocess_force_exit (spawn->process);
+    g_cancellable_cancel (spawn->cancellable);
+
+    /* Nothing is left to hand the output to once the read is cancelled. */
+    spawn->callback (spawn->output->len ? spawn->output : NULL, spawn->data);
+    spawn->callback = NULL;
+}
+
+void
+handler_changed (UzblVariableId id, gpointer data)
+{
+    UZBL_UNUSED (id);
+    UZBL_UNUSED (data);
+
+    uzbl_commands_clear_cache ();
+}
+
+void
+free_parsed_command (gpointer data)
+{
+    UzblParsedCommand *parsed = (UzblParsedCommand *)data;
+
+    uzbl_commands_args_free (parsed->argv);
+    g_free (parsed);
+}
+
+void
+clear_arg (gpointer data)
+{
+    g_free (*(gchar **)data);
+}
+
+gchar *
+expand_line (const gchar *cmd)
+{
+    if (!cmd || cmd[0] == '#' || !*cmd) {
+        return NULL;
+    }
+
+    gchar *exp_line = uzbl_variables_expand (cmd);
+    if (!exp_line || !*exp_line) {
+        g_free (exp_line);
+        return NULL;
+    }
+
+    return exp_line;
+}
+
+static void
+parse_command_arguments (const gchar *args, GArray *argv, gboolean split, GStringChunk *arena);
+
+const UzblCommand *
+parse_line (const gchar *line, GArray *argv, GStringChunk *arena)
+{
+    /* Separate the line into the command and its parameters. */
+    gchar **tokens = g_strsplit (line, " ", 2);
+
+    const gchar *command = tokens[0];
+    const gchar *arg_string = tokens[1];
+
+    /* Look up the command. */
+    const UzblCommand *info = name_table_lookup (uzbl.commands->table, command);
+
+    if (!info) {
+        uzbl_events_send (COMMAND_ERROR, NULL,
+            TYPE_STR, command,
+            NULL);
+
+        g_strfreev (tokens);
+
+        return NULL;
+    }
+
+    /* Parse the arguments. */
+    if (argv && arg_string) {
+        parse_command_arguments (arg_string, argv, info->split, arena);
+    }
+
+    g_strfreev (tokens);
+
+    return info;
+}
+
 static JSValueRef
 call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception);
 
@@ -329,14 +617,17 @@ init_js_commands_api ()
     JSClassRelease (command_class);
 }
 
-static GArray *
-split_quoted (const gchar *src);
+static void
+split_quoted (const gchar *src, GArray *argv, GStringChunk *arena);
 
 static gchar *
 unescape (gchar *src);
 
+static gchar *
+copy_arg (const gchar *arg, gsize len, GStringChunk *arena);
+
 void
-parse_command_arguments (const gchar *args, GArray *argv, gboolean split)
+parse_command_arguments (const gchar *args, GArray *argv, gboolean split, GStringChunk *arena)
 {
     if (!args) {
         return;
@@ -344,24 +635,84 @@ parse_command_arguments (const gchar *args, GArray *argv, gboolean split)
 
     if (!split) {
         /* Pass the parameters through in one chunk. */
-        uzbl_commands_args_append (argv, unescape (g_strdup (args)));
+        gchar *arg = unescape (copy_arg (args, strlen (args), arena));
+        g_array_append_val (argv, arg);
         return;
     }
 
-    GArray *par = split_quoted (args);
-    if (par) {
-        guint i;
-        for (i = 0; i < par->len; ++i) {
-            const gchar *arg = argv_idx (par, i);
-            uzbl_commands_args_append (argv, g_strdup (arg));
-        }
+    split_quoted (args, argv, arena);
+}
+
+gchar *
+copy_arg (const gchar *arg, gsize len, GStringChunk *arena)
+{
+    if (arena) {
+        return g_string_chunk_insert_len (arena, arg, len);
     }
 
-    uzbl_commands_args_free (par);
+    return g_strndup (arg, len);
 }
 
+static gboolean
+for_each_mapped_line (const gchar *path, UzblLineCallback callback, gpointer data);
+static gboolean
+for_each_read_line (const gchar *path, UzblLineCallback callback, gpointer data);
+
 gboolean
 for_each_line_in_file (const gchar *path, UzblLineCallback callback, gpointer data)
+{
+    struct stat st;
+
+    /* Pipes, FIFOs and devices (e.g., --config <(...)) cannot be mapped. */
+    if (!stat (path, &st) && S_ISREG (st.st_mode) &&
+        for_each_mapped_line (path, callback, data)) {
+        return TRUE;
+    }
+
+    return for_each_read_line (path, callback, data);
+}
+
+gboolean
+for_each_mapped_line (const gchar *path, UzblLineCallback callback, gpointer data)
+{
+    /* The mapping is private, so lines can be terminated (and stripped) in
+     * place without touching the file or copying them out. */
+    GMappedFile *file = g_mapped_file_new (path, TRUE, NULL);
+
+    if (!file) {
+        return FALSE;
+    }
+
+    gsize len = g_mapped_file_get_length (file);
+    gchar *head = g_mapped_file_get_contents (file);
+    gchar *end = head + len;
+    gchar *tail;
+
+    if (!len) {
+        g_mapped_file_unref (file);
+        return TRUE;
+    }
+
+    while ((tail = memchr (head, '\n', end - head))) {
+        *tail = '\0';
+        callback (head, data);
+        head = tail + 1;
+    }
+
+    /* There is no room to terminate a last line without a newline. */
+    if (head < end) {
+        gchar *line = g_strndup (head, end - head);
+        callback (line, data);
+        g_free (line);
+    }
+
+    g_mapped_file_unref (file);
+
+    return TRUE;
+}
+
+gboolean
+for_each_read_line (const gchar *path, UzblLineCallback callback, gpointer data)
 {
     gchar *line = NULL;
     gsize len;
@@ -383,10 +734,10 @@ for_each_line_in_file (const gchar *path, UzblLineCallback callback, gpointer da
 }
 
 static void
-parse_command_from_file (const char *cmd);
+parse_command_from_file (gchar *cmd);
 
 void
-parse_command_from_file_cb (const gchar *line, gpointer data)
+parse_command_from_file_cb (gchar *line, gpointer data)
 {
     UZBL_UNUSED (data);
 
@@ -402,7 +753,7 @@ call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, si
     JSValueRef command_val = uzbl_js_get (ctx, function, "name");
     gchar *command = uzbl_js_to_string (ctx, command_val);
 
-    UzblCommand *info = g_hash_table_lookup (uzbl.commands->table, command);
+    UzblCommand *info = name_table_lookup (uzbl.commands->table, command);
 
     if (!info) {
         gchar *error_str = g_strdup_printf ("Unknown command: %s", command);
@@ -454,17 +805,17 @@ call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, si
     return json_ret;
 }
 
-GArray *
-split_quoted (const gchar *src)
+void
+split_quoted (const gchar *src, GArray *argv, GStringChunk *arena)
 {
-    /* Split on unquoted space or tab, return array of strings; remove a layer
-     * of quotes and backslashes if unquote. */
+    /* Split on unquoted space or tab, append the strings to argv; remove a
+     * layer of quotes and backslashes if unquote. */
     if (!src) {
-        return NULL;
+        return;
     }
 
-    GArray *argv = uzbl_commands_args_new ();
     GString *str = g_string_new ("");
+    gchar *arg;
     const gchar *p = src;
 
     gboolean ctx_double_quote = FALSE;
@@ -492,7 +843,8 @@ split_quoted (const gchar *src)
             /* Argument separator. */
             while (isspace(*++p));
 
-            uzbl_commands_args_append (argv, g_strdup (str->str));
+            arg = copy_arg (str->str, str->len, arena);
+            g_array_append_val (argv, arg);
             g_string_truncate (str, 0);
         } else {
             /* Regular character. */
@@ -501,11 +853,10 @@ split_quoted (const gchar *src)
     }
 
     /* Append last argument. */
-    uzbl_commands_args_append (argv, g_strdup (str->str));
+    arg = copy_arg (str->str, str->len, arena);
+    g_array_append_val (argv, arg);
 
     g_string_free (str, TRUE);
-
-    return argv;
 }
 
 static gchar *
@@ -527,18 +878,16 @@ unescape (gchar *src)
 }
 
 void
-parse_command_from_file (const char *cmd)
+parse_command_from_file (gchar *cmd)
 {
     if (!cmd || !*cmd) {
         return;
     }
 
-    /* Strip trailing newline, and any other whitespace in front. */
-    gchar *work_string = g_strdup (cmd);
-    g_strstrip (work_string);
+    /* Strip any whitespace (including a carriage return) in place. */
+    g_strstrip (cmd);
 
-    uzbl_commands_run (work_string, NULL);
-    g_free (work_string);
+    uzbl_commands_run (cmd, NULL);
 }
 
 /* ========================= COMMAND TABLE ========================== */
@@ -565,6 +914,7 @@ DECLARE_COMMAND (download);
 /* Page commands */
 DECLARE_COMMAND (load);
 DECLARE_COMMAND (frame);
+DECLARE_COMMAND (prefetch);
 
 /* Cookie commands */
 DECLARE_COMMAND (cookie);
@@ -592,6 +942,7 @@ DECLARE_COMMAND (spell);
 #endif
 DECLARE_COMMAND (favicon);
 DECLARE_COMMAND (css);
+DECLARE_COMMAND (filter);
 DECLARE_COMMAND (scheme);
 
 /* Menu commands */
@@ -615,11 +966,16 @@ DECLARE_COMMAND (spawn_sync);
 DECLARE_COMMAND (spawn_sync_exec);
 DECLARE_COMMAND (spawn_sh);
 DECLARE_COMMAND (spawn_sh_sync);
+DECLARE_COMMAND (worker);
+DECLARE_COMMAND (worker_sync);
+DECLARE_COMMAND (worker_stop);
 
 /* Uzbl commands */
 DECLARE_COMMAND (chain);
 DECLARE_COMMAND (include);
 DECLARE_COMMAND (exit);
+DECLARE_COMMAND (io);
+DECLARE_COMMAND (decision_cache);
 
 /* Variable commands */
 DECLARE_COMMAND (set);
@@ -630,6 +986,7 @@ DECLARE_COMMAND (print);
 
 /* Event commands */
 DECLARE_COMMAND (event);
+DECLARE_COMMAND (subscribe);
 DECLARE_COMMAND (choose);
 DECLARE_COMMAND (request);
 
@@ -647,6 +1004,7 @@ builtin_command_table[] = {
     /* Page commands */
     { "load",                           cmd_load,                     TRUE,  TRUE  },
     { "frame",                          cmd_frame,                    TRUE,  TRUE  },
+    { "prefetch",                       cmd_prefetch,                 TRUE,  TRUE  },
 
     /* Cookie commands */
     { "cookie",                         cmd_cookie,                   TRUE,  TRUE  },
@@ -670,6 +1028,7 @@ builtin_command_table[] = {
 #endif
     { "favicon",                        cmd_favicon,                  TRUE,  TRUE  },
     { "css",                            cmd_css,                      TRUE,  TRUE  },
+    { "filter",                         cmd_filter,                   TRUE,  TRUE  },
     { "scheme",                         cmd_scheme,                   FALSE, TRUE  },
 
     /* Menu commands */
@@ -694,11 +1053,16 @@ builtin_command_table[] = {
     { "spawn_sync_exec",                cmd_spawn_sync_exec,          TRUE,  TRUE  },
     { "spawn_sh",                       cmd_spawn_sh,                 TRUE,  TRUE  },
     { "spawn_sh_sync",                  cmd_spawn_sh_sync,            TRUE,  TRUE  },
+    { "worker",                         cmd_worker,                   TRUE,  TRUE  },
+    { "worker_sync",                    cmd_worker_sync,              TRUE,  TRUE  },
+    { "worker_stop",                    cmd_worker_stop,              TRUE,  TRUE  },
 
     /* Uzbl commands */
     { "chain",                          cmd_chain,                    TRUE,  TRUE  },
     { "include",                        cmd_include,                  FALSE, TRUE  },
     { "exit",                           cmd_exit,                     TRUE,  TRUE  },
+    { "io",                             cmd_io,                       TRUE,  TRUE  },
+    { "decision_cache",                 cmd_decision_cache,           TRUE,  TRUE  },
 
     /* Variable commands */
     { "set",                            cmd_set,                      FALSE, FALSE },
@@ -710,6 +1074,7 @@ builtin_command_table[] = {
 
     /* Event commands */
     { "event",                          cmd_event,                    FALSE, FALSE },
+    { "subscribe",                      cmd_subscribe,                TRUE,  TRUE  },
     { "choose",                         cmd_choose,                   TRUE,  TRUE  },
     { "request",                        cmd_request,                  TRUE,  TRUE  },
 
@@ -783,7 +1148,7 @@ IMPLEMENT_COMMAND (uri)
 
     ARG_CHECK (argv, 1);
 
-    if (uzbl_variables_get_int ("frozen")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_FROZEN)) {
         return;
     }
 
@@ -798,6 +1163,7 @@ IMPLEMENT_COMMAND (uri)
 
     g_free (uzbl.state.uri);
     uzbl.state.uri = g_strdup (uri);
+    uzbl_gui_update_variable ("uri");
 
     /* Evaluate javascript: URIs. */
     if (g_str_has_prefix (uri, "javascript:")) {
@@ -845,7 +1211,7 @@ IMPLEMENT_COMMAND (load)
 {
     UZBL_UNUSED (result);
 
-    if (uzbl_variables_get_int ("frozen")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_FROZEN)) {
         return;
     }
 
@@ -932,6 +1298,17 @@ IMPLEMENT_COMMAND (frame)
     }
 }
 
+IMPLEMENT_COMMAND (prefetch)
+{
+    UZBL_UNUSED (result);
+
+    guint i;
+
+    for (i = 0; i < argv->len; ++i) {
+        uzbl_soup_prefetch (argv_idx (argv, i));
+    }
+}
+
 /* Cookie commands */
 
 IMPLEMENT_COMMAND (cookie)
@@ -1423,28 +1800,77 @@ IMPLEMENT_COMMAND (css)
     }
 }
 
-IMPLEMENT_COMMAND (scheme)
+IMPLEMENT_COMMAND (filter)
 {
     UZBL_UNUSED (result);
 
     ARG_CHECK (argv, 1);
 
-    gchar **split = g_strsplit (argv_idx (argv, 0), " ", 2);
+    const gchar *command = argv_idx (argv, 0);
 
-    gchar *scheme = split[0];
-    gchar *command = split[1];
+    if (!g_strcmp0 (command, "add")) {
+        ARG_CHECK (argv, 2);
 
-    if (scheme && command) {
-        uzbl_scheme_add_handler (g_strstrip (scheme), g_strchug (command));
-    }
+        gchar *rule = g_strjoinv (" ", (gchar **)argv->data + 1);
 
-    g_strfreev (split);
-}
+        uzbl_filter_add (rule);
 
-static void
-free_menu_item (gpointer item);
+        g_free (rule);
+    } else if (!g_strcmp0 (command, "load")) {
+        ARG_CHECK (argv, 2);
 
-/* Menu commands */
+        const gchar *path = argv_idx (argv, 1);
+
+        if (!uzbl_filter_load (path)) {
+            uzbl_debug ("Failed to load filter rules: %s\n", path);
+        }
+    } else if (!g_strcmp0 (command, "compile")) {
+        ARG_CHECK (argv, 3);
+
+        const gchar *source = argv_idx (argv, 1);
+        const gchar *path = argv_idx (argv, 2);
+
+        if (!uzbl_filter_compile (source, path)) {
+            uzbl_debug ("Failed to compile host list: %s\n", source);
+        }
+    } else if (!g_strcmp0 (command, "map")) {
+        ARG_CHECK (argv, 3);
+
+        const gchar *action = argv_idx (argv, 1);
+        const gchar *path = argv_idx (argv, 2);
+
+        if (!uzbl_filter_map (action, path)) {
+            uzbl_debug ("Failed to map host list: %s\n", path);
+        }
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_filter_clear ();
+    } else {
+        uzbl_debug ("Unrecognized filter command: %s\n", command);
+    }
+}
+
+IMPLEMENT_COMMAND (scheme)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    gchar **split = g_strsplit (argv_idx (argv, 0), " ", 2);
+
+    gchar *scheme = split[0];
+    gchar *command = split[1];
+
+    if (scheme && command) {
+        uzbl_scheme_add_handler (g_strstrip (scheme), g_strchug (command));
+    }
+
+    g_strfreev (split);
+}
+
+static void
+free_menu_item (gpointer item);
+
+/* Menu commands */
 IMPLEMENT_COMMAND (menu)
 {
     if (!uzbl.gui.menu_items) {
@@ -2086,6 +2512,40 @@ IMPLEMENT_COMMAND (spawn_sh_sync)
     spawn_sh (argv, result);
 }
 
+typedef struct _UzblWorkerPool UzblWorkerPool;
+
+static void
+worker_request (GArray *argv, GString *result);
+static UzblWorkerPool *
+get_worker_pool (const gchar *command);
+static void
+stop_worker_pool (UzblWorkerPool *pool, gboolean force);
+static void
+stop_worker_pool_cb (gpointer key, gpointer value, gpointer data);
+
+IMPLEMENT_COMMAND (worker)
+{
+    UZBL_UNUSED (result);
+
+    worker_request (argv, NULL);
+}
+
+IMPLEMENT_COMMAND (worker_sync)
+{
+    worker_request (argv, result);
+}
+
+IMPLEMENT_COMMAND (worker_stop)
+{
+    UZBL_UNUSED (result);
+
+    if (argv->len) {
+        stop_worker_pool (get_worker_pool (argv_idx (argv, 0)), FALSE);
+    } else {
+        g_hash_table_foreach (uzbl.commands->workers, stop_worker_pool_cb, NULL);
+    }
+}
+
 /* Uzbl commands */
 
 IMPLEMENT_COMMAND (chain)
@@ -2156,6 +2616,60 @@ IMPLEMENT_COMMAND (exit)
     uzbl_io_quit ();
 }
 
+IMPLEMENT_COMMAND (io)
+{
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "stats")) {
+        if (!result) {
+            return;
+        }
+
+        uzbl_io_dump_stats (result);
+    } else if (!g_strcmp0 (command, "framing")) {
+        ARG_CHECK (argv, 2);
+
+        const gchar *framing = argv_idx (argv, 1);
+        gboolean set = FALSE;
+
+        if (!g_strcmp0 (framing, "text")) {
+            set = uzbl_io_set_framing (UZBL_IO_FRAMING_TEXT);
+        } else if (!g_strcmp0 (framing, "binary")) {
+            set = uzbl_io_set_framing (UZBL_IO_FRAMING_BINARY);
+        } else {
+            uzbl_debug ("Unrecognized framing: %s\n", framing);
+            return;
+        }
+
+        if (!set) {
+            uzbl_debug ("io framing: not run from a socket\n");
+        }
+    } else {
+        uzbl_debug ("Unrecognized io command: %s\n", command);
+    }
+}
+
+IMPLEMENT_COMMAND (decision_cache)
+{
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "stats")) {
+        if (!result) {
+            return;
+        }
+
+        uzbl_gui_decision_cache_stats (result);
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_gui_decision_cache_clear ();
+    } else {
+        uzbl_debug ("Unrecognized decision_cache command: %s\n", command);
+    }
+}
+
 /* Variable commands */
 
 IMPLEMENT_COMMAND (set)
@@ -2252,6 +2766,33 @@ IMPLEMENT_COMMAND (event)
     g_strfreev (split);
 }
 
+IMPLEMENT_COMMAND (subscribe)
+{
+    UZBL_UNUSED (result);
+
+    UzblEventMask mask;
+    gboolean all = !argv->len;
+    guint i;
+
+    uzbl_events_mask_clear (&mask);
+
+    for (i = 0; i < argv->len; ++i) {
+        const gchar *name = argv_idx (argv, i);
+        UzblEventType type;
+
+        if (!uzbl_events_lookup (name, &type)) {
+            uzbl_debug ("Unrecognized event: %s\n", name);
+            continue;
+        }
+
+        uzbl_events_mask_add (&mask, type);
+    }
+
+    if (!uzbl_io_subscribe (all ? NULL : &mask)) {
+        uzbl_debug ("The subscribe command must be sent over a socket\n");
+    }
+}
+
 static void
 make_request (gint64 timeout, GArray *argv, GString *result);
 
@@ -2339,11 +2880,56 @@ free_menu_item (gpointer data)
  * properly escaped against whitespace, quotes etc.). */
 static gboolean
 run_system_command (GArray *args, char **output_stdout);
+static void
+spawn_output (GArray *args, GString *result, gboolean exec, gboolean strip);
+
+static GArray *
+spawn_args (GArray *argv);
+static GArray *
+spawn_sh_args (GArray *argv);
 
 void
 spawn (GArray *argv, GString *result, gboolean exec)
 {
-    ARG_CHECK (argv, 1);
+    GArray *args = spawn_args (argv);
+
+    if (!args) {
+        return;
+    }
+
+    if (result) {
+        spawn_output (args, result, exec, FALSE);
+    } else {
+        run_system_command (args, NULL);
+    }
+
+    uzbl_commands_args_free (args);
+}
+
+void
+spawn_sh (GArray *argv, GString *result)
+{
+    GArray *sh_cmd = spawn_sh_args (argv);
+
+    if (!sh_cmd) {
+        return;
+    }
+
+    if (result) {
+        spawn_output (sh_cmd, result, FALSE, TRUE);
+    } else {
+        run_system_command (sh_cmd, NULL);
+    }
+
+    uzbl_commands_args_free (sh_cmd);
+}
+
+GArray *
+spawn_args (GArray *argv)
+{
+    if (argv->len < 1) {
+        return NULL;
+    }
 
     const gchar *req_path = argv_idx (argv, 0);
 
@@ -2364,137 +2950,957 @@ spawn (GArray *argv, GString *result, gboolean exec)
         uzbl_commands_args_append (args, g_strdup (arg));
     }
 
-    gchar *r = NULL;
-    run_system_command (args, result ? &r : NULL);
-    if (result && r) {
-        g_string_append (result, r);
-        if (exec) {
-            /* Run each line of output from the program as a command. */
-            gchar *head = r;
-            gchar *tail;
-            while ((tail = strchr (head, '\n'))) {
-                *tail = '\0';
-                parse_command_from_file (head);
-                head = tail + 1;
-            }
-        }
-    }
-
-    g_free (r);
-    uzbl_commands_args_free (args);
+    return args;
 }
 
-void
-spawn_sh (GArray *argv, GString *result)
+GArray *
+spawn_sh_args (GArray *argv)
 {
-    gchar *shell = uzbl_variables_get_string ("shell_cmd");
+    gchar *shell = uzbl_variables_get_string_id (UZBL_VARIABLE_SHELL_CMD);
 
     if (!*shell) {
         uzbl_debug ("spawn_sh: shell_cmd is not set!\n");
         g_free (shell);
-        return;
+        return NULL;
     }
     guint i;
 
-    GArray *sh_cmd = split_quoted (shell);
+    GArray *sh_cmd = uzbl_commands_args_new ();
+    split_quoted (shell, sh_cmd, NULL);
     g_free (shell);
-    if (!sh_cmd) {
-        return;
-    }
 
     for (i = 0; i < argv->len; ++i) {
         const gchar *arg = argv_idx (argv, i);
         uzbl_commands_args_append (sh_cmd, g_strdup (arg));
     }
 
+    return sh_cmd;
+}
+
+typedef struct {
+    UzblIOPending *pending;
+    gboolean       exec;
+    gboolean       strip;
+} UzblSpawnOutput;
+
+static void
+handle_output (gchar *output, GString *result, gboolean exec, gboolean strip);
+static void
+spawn_output_done (GString *output, gpointer data);
+
+void
+spawn_output (GArray *args, GString *result, gboolean exec, gboolean strip)
+{
+    /* Answer later rather than block if the caller can wait. */
+    UzblIOPending *pending = uzbl_io_defer_result (result);
+
+    if (pending) {
+        UzblSpawnOutput *spawn_data = g_malloc (sizeof (UzblSpawnOutput));
+
+        spawn_data->pending = pending;
+        spawn_data->exec = exec;
+        spawn_data->strip = strip;
+
+        spawn_async (args, spawn_output_done, spawn_data);
+        return;
+    }
+
     gchar *r = NULL;
-    run_system_command (sh_cmd, result ? &r : NULL);
-    if (result && r) {
-        remove_trailing_newline (r);
-        g_string_append (result, r);
+    run_system_command (args, &r);
+    if (r) {
+        handle_output (r, result, exec, strip);
     }
 
     g_free (r);
-    uzbl_commands_args_free (sh_cmd);
 }
 
 void
-make_request (gint64 timeout, GArray *argv, GString *result)
+handle_output (gchar *output, GString *result, gboolean exec, gboolean strip)
 {
-    GString *request_name;
-    GString *request_result;
-    gchar **split = NULL;
+    if (strip) {
+        remove_trailing_newline (output);
+    }
+
+    g_string_append (result, output);
+
+    if (exec) {
+        /* Run each line of output from the program as a command. */
+        gchar *head = output;
+        gchar *tail;
+        while ((tail = strchr (head, '\n'))) {
+            *tail = '\0';
+            parse_command_from_file (head);
+            head = tail + 1;
+        }
+    }
+}
+
+void
+spawn_output_done (GString *output, gpointer data)
+{
+    UzblSpawnOutput *spawn_data = (UzblSpawnOutput *)data;
+    GString *result = g_string_new ("");
+
+    if (output) {
+        handle_output (output->str, result, spawn_data->exec, spawn_data->strip);
+    }
+
+    uzbl_io_complete_result (spawn_data->pending, result->str);
 
+    g_string_free (result, TRUE);
+    g_free (spawn_data);
+}
+
+typedef struct {
+    gchar                *cookie;
+    gchar                *line;
+    UzblCommandsCallback  callback;
+    gpointer              data;
+} UzblWorkerRequest;
+
+typedef struct {
+    UzblWorkerPool    *pool;
+    GSubprocess       *process;
+    GOutputStream     *input;
+    GDataInputStream  *output;
+    GCancellable      *cancellable;
+    guint              timeout;
+
+    /* The request being answered, if any, and whether to stop once it is. */
+    UzblWorkerRequest *request;
+    gboolean           retiring;
+    /* Whether a reply is being read asynchronously. */
+    gboolean           reading;
+} UzblWorker;
+
+struct _UzblWorkerPool {
+    gchar     *path;
+    GPtrArray *workers;
+    GQueue    *queue;
+    guint      next_cookie;
+};
+
+static UzblWorkerPool *
+get_worker_pool (const gchar *command);
+static UzblWorkerRequest *
+new_worker_request (UzblWorkerPool *pool, GArray *argv);
+static void
+free_worker_request (UzblWorkerRequest *req);
+static UzblWorker *
+idle_worker (UzblWorkerPool *pool, gboolean grow);
+static gboolean
+send_to_worker (UzblWorker *worker, UzblWorkerRequest *req);
+static gchar *
+read_worker_reply (UzblWorker *worker);
+static void
+dispatch_worker_requests (UzblWorkerPool *pool);
+static void
+stop_worker (UzblWorker *worker);
+static void
+worker_done (GString *reply, gpointer data);
+static guint
+worker_pool_size ();
+static GString *
+format_worker_request (const gchar *directive, const gchar *function, ...) G_GNUC_NULL_TERMINATED;
+
+void
+worker_request (GArray *argv, GString *result)
+{
     ARG_CHECK (argv, 1);
 
-    const gchar *request = argv_idx (argv, 0);
+    UzblWorkerPool *pool = get_worker_pool (argv_idx (argv, 0));
+    UzblWorkerRequest *req = new_worker_request (pool, argv);
 
-    request_name = g_string_ascii_up (g_string_new (request));
+    /* Answer later rather than block if the caller can wait. */
+    UzblIOPending *pending = uzbl_io_defer_result (result);
 
-    GArray *req_args = uzbl_commands_args_new ();
+    if (pending || !result) {
+        req->callback = pending ? worker_done : NULL;
+        req->data = pending;
 
-    guint i;
-    for (i = 1; i < argv->len; ++i) {
-        uzbl_commands_args_append (req_args, g_strdup (argv_idx (argv, i)));
+        g_queue_push_tail (pool->queue, req);
+        dispatch_worker_requests (pool);
+        return;
     }
 
-    request_result = uzbl_requests_send (timeout, request_name->str,
-        TYPE_STR_ARRAY, req_args,
-        NULL);
+    /* Otherwise this waits for a worker which is not busy, starting one if
+     * need be. */
+    UzblWorker *worker = idle_worker (pool, TRUE);
+    gchar *reply = NULL;
 
-    uzbl_commands_args_free (req_args);
+    if (worker && send_to_worker (worker, req)) {
+        reply = read_worker_reply (worker);
+        worker->request = NULL;
+    }
 
-    g_string_free (request_name, TRUE);
-    g_strfreev (split);
+    if (reply) {
+        g_string_append (result, reply);
+    } else if (worker) {
+        stop_worker (worker);
+        worker = NULL;
+    }
+
+    /* Extra workers started for a blocking request do not stay around. */
+    if (worker && (worker_pool_size () < pool->workers->len)) {
+        stop_worker (worker);
+    }
 
-    g_string_append (result, request_result->str);
-    g_string_free (request_result, TRUE);
+    g_free (reply);
+    free_worker_request (req);
 }
 
-gboolean
-string_is_integer (const char *s)
+void
+worker_done (GString *reply, gpointer data)
 {
-    /* Is the given string made up entirely of decimal digits? */
-    return (strspn (s, "0123456789") == strlen (s));
+    UzblIOPending *pending = (UzblIOPending *)data;
+
+    uzbl_io_complete_result (pending, reply ? reply->str : "");
 }
 
-gboolean
-run_system_command (GArray *args, char **output_stdout)
+guint
+worker_pool_size ()
 {
-    GError *err = NULL;
+    int size = uzbl_variables_get_int_id (UZBL_VARIABLE_WORKER_POOL_SIZE);
 
-    gboolean result;
-    if (output_stdout) {
-        result = g_spawn_sync (NULL, (gchar **)args->data, NULL, G_SPAWN_SEARCH_PATH,
-                               NULL, NULL, output_stdout, NULL, NULL, &err);
-        if (!result) {
-            *output_stdout = g_strdup ("");
-        }
-    } else {
-        result = g_spawn_async (NULL, (gchar **)args->data, NULL, G_SPAWN_SEARCH_PATH,
-                                NULL, NULL, NULL, &err);
-    }
+    return (0 < size) ? size : 1;
+}
 
-    if (uzbl_variables_get_int ("verbose")) {
-        GString *s = g_string_new ("spawned:");
-        guint i;
-        for (i = 0; i < args->len; ++i) {
-            gchar *qarg = g_shell_quote (argv_idx (args, i));
-            g_string_append_printf (s, " %s", qarg);
-            g_free (qarg);
-        }
-        g_string_append_printf (s, " -- result: %s", (result ? "true" : "false"));
-        printf ("%s\n", s->str);
-        g_string_free (s, TRUE);
-        if (output_stdout) {
-            printf ("Stdout: %s\n", *output_stdout);
-        }
+UzblWorkerPool *
+get_worker_pool (const gchar *command)
+{
+    gchar *path = find_existing_file (command);
+
+    if (!path) {
+        /* Assume it's a valid command. */
+        path = g_strdup (command);
     }
 
-    if (err) {
-        g_printerr ("error on run_system_command: %s\n", err->message);
-        g_error_free (err);
+    UzblWorkerPool *pool = g_hash_table_lookup (uzbl.commands->workers, path);
+
+    if (pool) {
+        g_free (path);
+        return pool;
     }
 
-    return result;
+    pool = g_malloc0 (sizeof (UzblWorkerPool));
+    pool->path = path;
+    pool->workers = g_ptr_array_new ();
+    pool->queue = g_queue_new ();
+
+    g_hash_table_insert (uzbl.commands->workers, pool->path, pool);
+
+    return pool;
+}
+
+UzblWorkerRequest *
+new_worker_request (UzblWorkerPool *pool, GArray *argv)
+{
+    UzblWorkerRequest *req = g_malloc0 (sizeof (UzblWorkerRequest));
+    GArray *args = g_array_new (TRUE, FALSE, sizeof (gchar *));
+    guint i;
+
+    /* Everything after the program is the request. */
+    for (i = 1; i < argv->len; ++i) {
+        gchar *arg = argv_idx (argv, i);
+        g_array_append_val (args, arg);
+    }
+
+    req->cookie = g_strdup_printf ("%u", ++pool->next_cookie);
+
+    gchar *directive = g_strdup_printf ("REQUEST-%s", req->cookie);
+    GString *line = format_worker_request (directive, "WORKER",
+        TYPE_STR_ARRAY, args,
+        NULL);
+
+    req->line = g_string_free (line, FALSE);
+
+    g_free (directive);
+    g_array_free (args, TRUE);
+
+    return req;
+}
+
+GString *
+format_worker_request (const gchar *directive, const gchar *function, ...)
+{
+    va_list vargs;
+
+    va_start (vargs, function);
+    GString *line = uzbl_comm_vformat (directive, function, vargs);
+    va_end (vargs);
+
+    return line;
+}
+
+void
+free_worker_request (UzblWorkerRequest *req)
+{
+    g_free (req->cookie);
+    g_free (req->line);
+    g_free (req);
+}
+
+static UzblWorker *
+start_worker (UzblWorkerPool *pool);
+
+UzblWorker *
+idle_worker (UzblWorkerPool *pool, gboolean grow)
+{
+    guint i;
+
+    for (i = 0; i < pool->workers->len; ++i) {
+        UzblWorker *worker = g_ptr_array_index (pool->workers, i);
+
+        if (!worker->request) {
+            return worker;
+        }
+    }
+
+    if (!grow && (worker_pool_size () <= pool->workers->len)) {
+        return NULL;
+    }
+
+    return start_worker (pool);
+}
+
+UzblWorker *
+start_worker (UzblWorkerPool *pool)
+{
+    GError *err = NULL;
+    const gchar *argv[] = { pool->path, NULL };
+
+    GSubprocess *process = g_subprocess_newv (argv,
+        G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE, &err);
+
+    if (!process) {
+        g_printerr ("error starting worker: %s\n", err->message);
+        g_error_free (err);
+        return NULL;
+    }
+
+    uzbl_debug ("Started worker %s\n", pool->path);
+
+    UzblWorker *worker = g_malloc0 (sizeof (UzblWorker));
+
+    worker->pool = pool;
+    worker->process = process;
+    worker->input = g_subprocess_get_stdin_pipe (process);
+    worker->output = g_data_input_stream_new (g_subprocess_get_stdout_pipe (process));
+    worker->cancellable = g_cancellable_new ();
+
+    g_ptr_array_add (pool->workers, worker);
+
+    return worker;
+}
+
+gboolean
+send_to_worker (UzblWorker *worker, UzblWorkerRequest *req)
+{
+    GError *err = NULL;
+
+    worker->request = req;
+
+    if (!g_output_stream_write_all (worker->input, req->line, strlen (req->line), NULL, NULL, &err) ||
+        !g_output_stream_flush (worker->input, NULL, &err)) {
+        g_printerr ("error writing to worker: %s\n", err->message);
+        g_error_free (err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static const gchar *
+match_reply (const gchar *line, const UzblWorkerRequest *req);
+
+typedef struct {
+    GMutex        lock;
+    GCond         cond;
+    gboolean      done;
+    gint64        deadline;
+    GSubprocess  *process;
+    GCancellable *cancellable;
+} UzblWorkerWatchdog;
+
+static gpointer
+watch_worker (gpointer data);
+
+gchar *
+read_worker_reply (UzblWorker *worker)
+{
+    UzblWorkerWatchdog dog;
+    GThread *thread = NULL;
+    gchar *line;
+    gchar *result = NULL;
+
+    /* The main loop is blocked, so a timeout source would never fire. */
+    int timeout = uzbl_variables_get_int_id (UZBL_VARIABLE_SPAWN_TIMEOUT);
+
+    g_mutex_init (&dog.lock);
+    g_cond_init (&dog.cond);
+    dog.done = FALSE;
+    dog.deadline = g_get_monotonic_time () + timeout * G_TIME_SPAN_SECOND;
+    dog.process = worker->process;
+    dog.cancellable = g_cancellable_new ();
+
+    if (0 < timeout) {
+        thread = g_thread_new ("uzbl-worker-watchdog", watch_worker, &dog);
+    }
+
+    /* Anything which is not the reply is ignored. */
+    while ((line = g_data_input_stream_read_line (worker->output, NULL, dog.cancellable, NULL))) {
+        const gchar *reply = match_reply (line, worker->request);
+
+        if (reply) {
+            result = g_strdup (reply);
+            g_free (line);
+            break;
+        }
+
+        g_free (line);
+    }
+
+    if (thread) {
+        g_mutex_lock (&dog.lock);
+        dog.done = TRUE;
+        g_cond_signal (&dog.cond);
+        g_mutex_unlock (&dog.lock);
+
+        g_thread_join (thread);
+    }
+
+    if (g_cancellable_is_cancelled (dog.cancellable)) {
+        uzbl_debug ("Worker %s timed out\n", worker->pool->path);
+    }
+
+    g_object_unref (dog.cancellable);
+    g_cond_clear (&dog.cond);
+    g_mutex_clear (&dog.lock);
+
+    return result;
+}
+
+gpointer
+watch_worker (gpointer data)
+{
+    UzblWorkerWatchdog *dog = (UzblWorkerWatchdog *)data;
+    gboolean expired = FALSE;
+
+    g_mutex_lock (&dog->lock);
+    while (!dog->done) {
+        if (!g_cond_wait_until (&dog->cond, &dog->lock, dog->deadline)) {
+            expired = !dog->done;
+            break;
+        }
+    }
+    g_mutex_unlock (&dog->lock);
+
+    /* The read then fails and the worker is stopped. */
+    if (expired) {
+        g_subprocess_force_exit (dog->process);
+        g_cancellable_cancel (dog->cancellable);
+    }
+
+    return NULL;
+}
+
+const gchar *
+match_reply (const gchar *line, const UzblWorkerRequest *req)
+{
+    gsize cookie_len = strlen (req->cookie);
+
+    /* Replies look like "REPLY-<cookie> <reply>". */
+    if (!g_str_has_prefix (line, "REPLY-")) {
+        return NULL;
+    }
+
+    line += strlen ("REPLY-");
+
+    if (strncmp (line, req->cookie, cookie_len)) {
+        return NULL;
+    }
+
+    line += cookie_len;
+
+    if (*line == ' ') {
+        return line + 1;
+    }
+
+    return *line ? NULL : line;
+}
+
+static void
+wait_for_worker_reply (UzblWorker *worker);
+static gboolean
+worker_timed_out (gpointer data);
+static void
+fail_worker_requests (UzblWorkerPool *pool);
+
+void
+dispatch_worker_requests (UzblWorkerPool *pool)
+{
+    while (!g_queue_is_empty (pool->queue)) {
+        UzblWorker *worker = idle_worker (pool, FALSE);
+
+        if (!worker) {
+            /* Nothing would ever answer. */
+            if (!pool->workers->len) {
+                fail_worker_requests (pool);
+            }
+            break;
+        }
+
+        UzblWorkerRequest *req = g_queue_pop_head (pool->queue);
+
+        if (!send_to_worker (worker, req)) {
+            if (req->callback) {
+                req->callback (NULL, req->data);
+            }
+            free_worker_request (req);
+
+            stop_worker (worker);
+            continue;
+        }
+
+        int timeout = uzbl_variables_get_int_id (UZBL_VARIABLE_SPAWN_TIMEOUT);
+        if (0 < timeout) {
+            worker->timeout = g_timeout_add_seconds (timeout, worker_timed_out, worker);
+        }
+
+        wait_for_worker_reply (worker);
+    }
+}
+
+static void
+worker_replied (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+wait_for_worker_reply (UzblWorker *worker)
+{
+    worker->reading = TRUE;
+    g_data_input_stream_read_line_async (worker->output, G_PRIORITY_DEFAULT, worker->cancellable,
+        worker_replied, worker);
+}
+
+static void
+free_worker (UzblWorker *worker);
+
+void
+worker_replied (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UzblWorker *worker = (UzblWorker *)data;
+    UzblWorkerRequest *req = worker->request;
+
+    gchar *line = g_data_input_stream_read_line_finish (G_DATA_INPUT_STREAM (source), res, NULL, NULL);
+
+    worker->reading = FALSE;
+
+    /* The worker was stopped (and its request failed) while this was
+     * pending; it was only kept around until now. */
+    if (g_cancellable_is_cancelled (worker->cancellable)) {
+        g_free (line);
+        free_worker (worker);
+        return;
+    }
+
+    if (line && !match_reply (line, req)) {
+        /* Not the reply; keep waiting. */
+        g_free (line);
+        wait_for_worker_reply (worker);
+        return;
+    }
+
+    if (worker->timeout) {
+        g_source_remove (worker->timeout);
+        worker->timeout = 0;
+    }
+
+    worker->request = NULL;
+
+    UzblWorkerPool *pool = worker->pool;
+
+    if (req->callback) {
+        GString *reply = line ? g_string_new (match_reply (line, req)) : NULL;
+
+        req->callback (reply, req->data);
+
+        if (reply) {
+            g_string_free (reply, TRUE);
+        }
+    }
+
+    /* The worker is gone (or was killed). */
+    if (!line || worker->retiring) {
+        stop_worker (worker);
+    }
+
+    g_free (line);
+    free_worker_request (req);
+
+    dispatch_worker_requests (pool);
+}
+
+void
+fail_worker_requests (UzblWorkerPool *pool)
+{
+    UzblWorkerRequest *req;
+
+    while ((req = g_queue_pop_head (pool->queue))) {
+        if (req->callback) {
+            req->callback (NULL, req->data);
+        }
+        free_worker_request (req);
+    }
+}
+
+gboolean
+worker_timed_out (gpointer data)
+{
+    UzblWorker *worker = (UzblWorker *)data;
+
+    uzbl_debug ("Worker %s timed out\n", worker->pool->path);
+
+    /* The source is destroyed on return. */
+    worker->timeout = 0;
+
+    /* The pending read then fails, which fails the request. */
+    g_subprocess_force_exit (worker->process);
+
+    return FALSE;
+}
+
+void
+stop_worker (UzblWorker *worker)
+{
+    g_ptr_array_remove (worker->pool->workers, worker);
+
+    if (worker->timeout) {
+        g_source_remove (worker->timeout);
+    }
+
+    /* Workers are expected to exit once their input is closed. */
+    g_output_stream_close (worker->input, NULL, NULL);
+
+    /* A pending read still refers to the worker; it frees it instead. */
+    if (worker->reading) {
+        g_cancellable_cancel (worker->cancellable);
+        return;
+    }
+
+    free_worker (worker);
+}
+
+void
+free_worker (UzblWorker *worker)
+{
+    g_object_unref (worker->cancellable);
+    g_object_unref (worker->output);
+    g_object_unref (worker->process);
+    g_free (worker);
+}
+
+void
+stop_worker_pool (UzblWorkerPool *pool, gboolean force)
+{
+    guint i;
+
+    for (i = pool->workers->len; i; --i) {
+        UzblWorker *worker = g_ptr_array_index (pool->workers, i - 1);
+
+        if (worker->request && !force) {
+            /* Let it finish the request first. */
+            worker->retiring = TRUE;
+            continue;
+        }
+
+        if (worker->reading) {
+            /* Nothing will answer the request once the worker is gone. */
+            UzblWorkerRequest *req = worker->request;
+
+            worker->request = NULL;
+            if (req->callback) {
+                req->callback (NULL, req->data);
+            }
+            free_worker_request (req);
+        }
+
+        stop_worker (worker);
+    }
+}
+
+void
+stop_worker_pool_cb (gpointer key, gpointer value, gpointer data)
+{
+    UZBL_UNUSED (key);
+    UZBL_UNUSED (data);
+
+    stop_worker_pool ((UzblWorkerPool *)value, FALSE);
+}
+
+void
+free_worker_pool (gpointer data)
+{
+    UzblWorkerPool *pool = (UzblWorkerPool *)data;
+
+    stop_worker_pool (pool, TRUE);
+
+    g_ptr_array_free (pool->workers, TRUE);
+    g_queue_free_full (pool->queue, (GDestroyNotify)free_worker_request);
+    g_free (pool->path);
+    g_free (pool);
+}
+
+static void
+request_done (GString *reply, gpointer data);
+
+void
+make_request (gint64 timeout, GArray *argv, GString *result)
+{
+    GString *request_name;
+    GString *request_result;
+    gchar **split = NULL;
+
+    ARG_CHECK (argv, 1);
+
+    const gchar *request = argv_idx (argv, 0);
+
+    request_name = g_string_ascii_up (g_string_new (request));
+
+    GArray *req_args = uzbl_commands_args_new ();
+
+    guint i;
+    for (i = 1; i < argv->len; ++i) {
+        uzbl_commands_args_append (req_args, g_strdup (argv_idx (argv, i)));
+    }
+
+    /* Answer later rather than block if the caller can wait. */
+    UzblIOPending *pending = uzbl_io_defer_result (result);
+
+    if (pending) {
+        uzbl_requests_send_async (timeout, request_done, pending, request_name->str,
+            TYPE_STR_ARRAY, req_args,
+            NULL);
+    } else {
+        request_result = uzbl_requests_send (timeout, request_name->str,
+            TYPE_STR_ARRAY, req_args,
+            NULL);
+
+        g_string_append (result, request_result->str);
+        g_string_free (request_result, TRUE);
+    }
+
+    uzbl_commands_args_free (req_args);
+
+    g_string_free (request_name, TRUE);
+    g_strfreev (split);
+}
+
+void
+request_done (GString *reply, gpointer data)
+{
+    UzblIOPending *pending = (UzblIOPending *)data;
+
+    uzbl_io_complete_result (pending, reply ? reply->str : "");
+}
+
+gboolean
+string_is_integer (const char *s)
+{
+    /* Is the given string made up entirely of decimal digits? */
+    return (strspn (s, "0123456789") == strlen (s));
+}
+
+static void
+print_spawned (GArray *args, gboolean result);
+
+gboolean
+run_system_command (GArray *args, char **output_stdout)
+{
+    GError *err = NULL;
+
+    gboolean result;
+    if (output_stdout) {
+        result = g_spawn_sync (NULL, (gchar **)args->data, NULL, G_SPAWN_SEARCH_PATH,
+                               NULL, NULL, output_stdout, NULL, NULL, &err);
+        if (!result) {
+            *output_stdout = g_strdup ("");
+        }
+    } else {
+        result = g_spawn_async (NULL, (gchar **)args->data, NULL, G_SPAWN_SEARCH_PATH,
+                                NULL, NULL, NULL, &err);
+    }
+
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_VERBOSE)) {
+        print_spawned (args, result);
+        if (output_stdout) {
+            printf ("Stdout: %s\n", *output_stdout);
+        }
+    }
+
+    if (err) {
+        g_printerr ("error on run_system_command: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    return result;
+}
+
+void
+print_spawned (GArray *args, gboolean result)
+{
+    GString *s = g_string_new ("spawned:");
+    guint i;
+    for (i = 0; i < args->len; ++i) {
+        gchar *qarg = g_shell_quote (argv_idx (args, i));
+        g_string_append_printf (s, " %s", qarg);
+        g_free (qarg);
+    }
+    g_string_append_printf (s, " -- result: %s", (result ? "true" : "false"));
+    printf ("%s\n", s->str);
+    g_string_free (s, TRUE);
+}
+
+static void
+read_spawn_output (UzblSpawn *spawn);
+static void
+finish_spawn (UzblSpawn *spawn, gboolean success);
+static gboolean
+spawn_timed_out (gpointer data);
+
+gboolean
+spawn_async (GArray *args, UzblCommandsCallback callback, gpointer data)
+{
+    GError *err = NULL;
+
+    /* Like G_SPAWN_SEARCH_PATH, the program is looked up in PATH. */
+    GSubprocess *process = g_subprocess_newv ((const gchar * const *)args->data,
+        G_SUBPROCESS_FLAGS_STDOUT_PIPE, &err);
+
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_VERBOSE)) {
+        print_spawned (args, process != NULL);
+    }
+
+    if (!process) {
+        g_printerr ("error on spawn_async: %s\n", err->message);
+        g_error_free (err);
+
+        callback (NULL, data);
+        return FALSE;
+    }
+
+    UzblSpawn *spawn = g_malloc0 (sizeof (UzblSpawn));
+
+    spawn->process = process;
+    spawn->output_stream = g_subprocess_get_stdout_pipe (process);
+    spawn->output = g_string_new ("");
+    spawn->cancellable = g_cancellable_new ();
+    spawn->callback = callback;
+    spawn->data = data;
+
+    int timeout = uzbl_variables_get_int_id (UZBL_VARIABLE_SPAWN_TIMEOUT);
+    if (0 < timeout) {
+        spawn->timeout = g_timeout_add_seconds (timeout, spawn_timed_out, spawn);
+    }
+
+    g_hash_table_add (uzbl.commands->spawns, spawn);
+
+    read_spawn_output (spawn);
+
+    return TRUE;
+}
+
+static void
+spawn_output_read (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+read_spawn_output (UzblSpawn *spawn)
+{
+    g_input_stream_read_bytes_async (spawn->output_stream, 4096, G_PRIORITY_DEFAULT,
+        spawn->cancellable, spawn_output_read, spawn);
+}
+
+static void
+spawn_exited (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+spawn_output_read (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UzblSpawn *spawn = (UzblSpawn *)data;
+    GError *err = NULL;
+
+    GBytes *bytes = g_input_stream_read_bytes_finish (G_INPUT_STREAM (source), res, &err);
+
+    if (!bytes) {
+        if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_printerr ("error reading spawned output: %s\n", err->message);
+        }
+        g_error_free (err);
+
+        finish_spawn (spawn, FALSE);
+        return;
+    }
+
+    gsize len;
+    gconstpointer chunk = g_bytes_get_data (bytes, &len);
+
+    if (!len) {
+        /* End of output; collect the process. */
+        g_bytes_unref (bytes);
+        g_subprocess_wait_async (spawn->process, spawn->cancellable, spawn_exited, spawn);
+        return;
+    }
+
+    g_string_append_len (spawn->output, chunk, len);
+    g_bytes_unref (bytes);
+
+    read_spawn_output (spawn);
+}
+
+void
+spawn_exited (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UzblSpawn *spawn = (UzblSpawn *)data;
+
+    gboolean success = g_subprocess_wait_finish (G_SUBPROCESS (source), res, NULL);
+
+    finish_spawn (spawn, success);
+}
+
+gboolean
+spawn_timed_out (gpointer data)
+{
+    UzblSpawn *spawn = (UzblSpawn *)data;
+
+    uzbl_debug ("Spawned process timed out\n");
+
+    /* The source is destroyed on return. */
+    spawn->timeout = 0;
+
+    g_subprocess_force_exit (spawn->process);
+    g_cancellable_cancel (spawn->cancellable);
+
+    return FALSE;
+}
+
+void
+finish_spawn (UzblSpawn *spawn, gboolean success)
+{
+    if (spawn->timeout) {
+        g_source_remove (spawn->timeout);
+    }
+
+    if (uzbl.commands) {
+        g_hash_table_remove (uzbl.commands->spawns, spawn);
+    }
+
+    /* Whatever was read before a failure is still handed over (unless it
+     * already was when the commands were freed). */
+    if (spawn->callback) {
+        spawn->callback ((success || spawn->output->len) ? spawn->output : NULL, spawn->data);
+    }
+
+    g_string_free (spawn->output, TRUE);
+    g_object_unref (spawn->cancellable);
+    g_object_unref (spawn->process);
+    g_free (spawn);
 }
@@ -6,6 +6,9 @@
 struct _UzblCommand;
 typedef struct _UzblCommand UzblCommand;
 
+/* Arguments passed to a command are only valid until it returns; a command
+ * which needs them later must copy them. Arrays from uzbl_commands_args_new
+ * own their strings and may be kept and appended to. */
 GArray *
 uzbl_commands_args_new ();
 void
@@ -15,6 +18,11 @@ uzbl_commands_args_free (GArray *argv);
 
 const UzblCommand *
 uzbl_commands_parse (const gchar *cmd, GArray *argv);
+/* For handlers: the parse of the expanded line is kept for next time. */
+const UzblCommand *
+uzbl_commands_parse_cached (const gchar *cmd, GArray *argv);
+void
+uzbl_commands_clear_cache ();
 void
 uzbl_commands_run_parsed (const UzblCommand *info, GArray *argv, GString *result);
 void
@@ -22,6 +30,14 @@ uzbl_commands_run_argv (const gchar *cmd, GArray *argv, GString *result);
 void
 uzbl_commands_run (const gchar *cmd, GString *result);
 
+/* Receives the result, or NULL if the command could not be run. */
+typedef void (*UzblCommandsCallback)(GString *result, gpointer data);
+
+/* Runs the command later and hands its result to the callback. Programs run
+ * by spawn_sync and spawn_sh_sync do not block uzbl while they run. */
+void
+uzbl_commands_run_async (const gchar *cmd, UzblCommandsCallback callback, gpointer data);
+
 void
 uzbl_commands_load_file (const gchar *path);
 
@@ -15,6 +15,12 @@ default_config[] = {
 "set maintain_history 1", /* Set here since the WebKit default is 1, but there's no way to get the current value. */
 "set forward_keys 1", /* Forward keys by default so that webpages work as expected without a config. */
 "set zoom_text_only 0", /* Zoom all content by default; text-only is not as useful. */
+"set request_handler_async 1", /* Slow handlers should not stall other resources; see the README for the limits on rewrites. */
+"set decision_cache_size 256", /* Enough for the resources of a few pages; entries are small and evicted oldest first. */
+"set decision_cache_ttl 60", /* Only used when a handler asks for caching without giving a lifetime. */
+"set prefetch_on_hover 0", /* Looking up every hovered link tells the resolver where the mouse went; opt in. */
+"set prefetch_rate 4", /* A handful per second keeps up with hovering without flooding the resolver. */
+"set prefetch_host_budget 2", /* A second lookup covers a record expiring within the minute; more is wasted. */
 NULL
 };
 
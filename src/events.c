@@ -46,15 +46,137 @@ uzbl_events_send (UzblEventType type, const gchar *custom_event, ...)
     va_end (vargs);
 }
 
+gboolean
+uzbl_events_listening (UzblEventType type)
+{
+    return uzbl_io_event_wanted (type) != 0;
+}
+
+gboolean
+uzbl_events_lookup (const gchar *name, UzblEventType *type)
+{
+    guint i;
+
+    for (i = 0; i < LAST_EVENT; ++i) {
+        if (!g_strcmp0 (event_table[i], name)) {
+            *type = i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void
+uzbl_events_mask_fill (UzblEventMask *mask)
+{
+    guint i;
+
+    uzbl_events_mask_clear (mask);
+
+    for (i = 0; i < LAST_EVENT; ++i) {
+        uzbl_events_mask_add (mask, i);
+    }
+}
+
+void
+uzbl_events_mask_clear (UzblEventMask *mask)
+{
+    memset (mask->bits, 0, sizeof (mask->bits));
+}
+
+void
+uzbl_events_mask_add (UzblEventMask *mask, UzblEventType type)
+{
+    mask->bits[type / 32] |= (1u << (type % 32));
+}
+
+void
+uzbl_events_mask_merge (UzblEventMask *mask, const UzblEventMask *other)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (mask->bits); ++i) {
+        mask->bits[i] |= other->bits[i];
+    }
+}
+
+gboolean
+uzbl_events_mask_has (const UzblEventMask *mask, UzblEventType type)
+{
+    if (type >= LAST_EVENT) {
+        return FALSE;
+    }
+
+    return (mask->bits[type / 32] & (1u << (type % 32))) != 0;
+}
+
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
+static UzblIOFlags
+event_flags (UzblEventType type, const gchar *custom_event);
+
 static void
 vuzbl_events_send (UzblEventType type, const gchar *custom_event, va_list vargs)
 {
+    UzblIOFraming framing = uzbl_io_event_wanted (type);
+
+    /* Skip formatting entirely if nobody wants to hear about it. */
+    if (!framing) {
+        return;
+    }
+
     const gchar *event_name = custom_event ? custom_event : event_table[type];
-    GString *event = uzbl_comm_vformat ("EVENT", event_name, vargs);
+    GString *event = NULL;
+    GBytes *frame = NULL;
+    va_list vacopy;
 
-    uzbl_io_send (event->str, FALSE);
+    /* Only build the encodings somebody reads. */
+    if (framing & UZBL_IO_FRAMING_TEXT) {
+        va_copy (vacopy, vargs);
+        event = uzbl_comm_vformat ("EVENT", event_name, vacopy);
+        va_end (vacopy);
+    }
+
+    if (framing & UZBL_IO_FRAMING_BINARY) {
+        va_copy (vacopy, vargs);
+        frame = uzbl_comm_vformat_frame ("EVENT", event_name, vacopy);
+        va_end (vacopy);
+    }
+
+    uzbl_io_send_event (type, event ? event->str : NULL, frame, event_flags (type, custom_event));
+
+    if (event) {
+        g_string_free (event, TRUE);
+    }
+    if (frame) {
+        g_bytes_unref (frame);
+    }
+}
 
-    g_string_free (event, TRUE);
+UzblIOFlags
+event_flags (UzblEventType type, const gchar *custom_event)
+{
+    if (custom_event) {
+        return 0;
+    }
+
+    switch (type) {
+    /* Only the latest state matters for these. */
+    case LOAD_PROGRESS:
+    case SCROLL_VERT:
+    case SCROLL_HORIZ:
+    case GEOMETRY_CHANGED:
+        return UZBL_IO_COALESCE;
+    /* Input handling in the event manager should not wait for a batch. */
+    case KEY_PRESS:
+    case KEY_RELEASE:
+    case MOD_PRESS:
+    case MOD_RELEASE:
+    case FORM_ACTIVE:
+    case ROOT_ACTIVE:
+        return UZBL_IO_URGENT;
+    default:
+        return 0;
+    }
 }
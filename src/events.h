@@ -74,4 +74,28 @@ typedef enum {
 void
 uzbl_events_send (UzblEventType type, const gchar *custom_event, ...) G_GNUC_NULL_TERMINATED;
 
+/* Whether sending the event would reach anyone. Call sites may use this to
+ * avoid preparing costly arguments. */
+gboolean
+uzbl_events_listening (UzblEventType type);
+
+gboolean
+uzbl_events_lookup (const gchar *name, UzblEventType *type);
+
+/* A set of event types. */
+typedef struct {
+    guint32 bits[(LAST_EVENT + 31) / 32];
+} UzblEventMask;
+
+void
+uzbl_events_mask_fill (UzblEventMask *mask);
+void
+uzbl_events_mask_clear (UzblEventMask *mask);
+void
+uzbl_events_mask_add (UzblEventMask *mask, UzblEventType type);
+void
+uzbl_events_mask_merge (UzblEventMask *mask, const UzblEventMask *other);
+gboolean
+uzbl_events_mask_has (const UzblEventMask *mask, UzblEventType type);
+
 #endif
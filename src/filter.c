@@ -0,0 +1,890 @@
+#include "filter.h"
+
+#include "util.h"
+#include "uzbl-core.h"
+
+#include <string.h>
+
+/* An Aho-Corasick automaton which finds any of a set of URL substrings in a
+ * single pass over the URI. */
+typedef struct {
+    /* Transitions, keyed by EDGE_KEY. The root is never a target, so a
+     * missing transition reads as 0. */
+    GHashTable *edges;
+    GArray     *states;
+} UzblSubstrings;
+
+typedef struct {
+    guint    parent;
+    guint    depth;
+    guint    fail;
+    guchar   byte;
+    /* Set if a substring ends here or at any state along the failure
+     * links. */
+    gboolean match;
+} UzblSubstringState;
+
+#define EDGE_KEY(state, byte) GSIZE_TO_POINTER (((gsize)(state) << 8) | (byte))
+
+/* A compiled host list is laid out as:
+ *
+ *   - the magic string (8 bytes)
+ *   - the number of hosts (little-endian guint32)
+ *   - 4 reserved bytes
+ *   - an offset into the string table for each host (little-endian guint32)
+ *   - the string table
+ *
+ * The hosts are NUL-terminated, reversed, and have their dots replaced by
+ * HOST_SEPARATOR so that they sort by domain label. They are sorted and no
+ * host is a subdomain of another, so the only entry which can match a host
+ * is the last one which sorts at or before it. */
+#define HOST_MAP_MAGIC "UZBLHST1"
+#define HOST_MAP_HEADER_SIZE 16
+#define HOST_SEPARATOR '\001'
+
+typedef struct {
+    GMappedFile   *file;
+    const guint32 *offsets;
+    guint32        count;
+    const gchar   *strings;
+    gsize          strings_len;
+} UzblHostMap;
+
+typedef struct {
+    /* Domain suffixes, lowercase. */
+    GHashTable     *hosts;
+    UzblHostMap    *map;
+    /* Sources for the compiled matchers. */
+    GPtrArray      *substrings;
+    GPtrArray      *patterns;
+
+    /* Rebuilt on first use after a change. */
+    gboolean        dirty;
+    UzblSubstrings *matcher;
+    GRegex         *regex;
+} UzblFilterList;
+
+typedef struct {
+    GRegex *regex;
+    gchar  *replacement;
+} UzblFilterRewrite;
+
+struct _UzblFilter {
+    UzblFilterList  allow;
+    UzblFilterList  block;
+    GPtrArray      *rewrites;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+list_init (UzblFilterList *list);
+static void
+list_free (UzblFilterList *list);
+static void
+free_rewrite (gpointer data);
+
+void
+uzbl_filter_init ()
+{
+    uzbl.filter = g_malloc (sizeof (UzblFilter));
+
+    list_init (&uzbl.filter->allow);
+    list_init (&uzbl.filter->block);
+    uzbl.filter->rewrites = g_ptr_array_new_with_free_func (free_rewrite);
+}
+
+void
+uzbl_filter_free ()
+{
+    list_free (&uzbl.filter->allow);
+    list_free (&uzbl.filter->block);
+    g_ptr_array_free (uzbl.filter->rewrites, TRUE);
+
+    g_free (uzbl.filter);
+    uzbl.filter = NULL;
+}
+
+static gboolean
+list_add (UzblFilterList *list, const gchar *kind, const gchar *pattern);
+static gboolean
+add_rewrite (const gchar *pattern, const gchar *replacement);
+
+gboolean
+uzbl_filter_add (const gchar *rule)
+{
+    gchar **words = g_strsplit_set (rule, " \t", -1);
+    gchar **word;
+    guint n = 0;
+    gboolean ok = FALSE;
+
+    /* Drop the empty words between runs of whitespace. */
+    for (word = words; *word; ++word) {
+        if (**word) {
+            words[n++] = *word;
+        } else {
+            g_free (*word);
+        }
+    }
+    words[n] = NULL;
+
+    if (n == 3 && !g_strcmp0 (words[0], "allow")) {
+        ok = list_add (&uzbl.filter->allow, words[1], words[2]);
+    } else if (n == 3 && !g_strcmp0 (words[0], "block")) {
+        ok = list_add (&uzbl.filter->block, words[1], words[2]);
+    } else if (n == 4 && !g_strcmp0 (words[0], "rewrite") && !g_strcmp0 (words[1], "regex")) {
+        ok = add_rewrite (words[2], words[3]);
+    }
+
+    if (!ok) {
+        uzbl_debug ("Invalid filter rule: %s\n", rule);
+    }
+
+    g_strfreev (words);
+
+    return ok;
+}
+
+gboolean
+uzbl_filter_load (const gchar *path)
+{
+    gchar *contents;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        return FALSE;
+    }
+
+    gchar *line = contents;
+    while (line) {
+        gchar *next = strchr (line, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+
+        g_strstrip (line);
+        if (*line && *line != '#') {
+            uzbl_filter_add (line);
+        }
+
+        line = next;
+    }
+
+    g_free (contents);
+
+    return TRUE;
+}
+
+static void
+list_clear (UzblFilterList *list);
+
+void
+uzbl_filter_clear ()
+{
+    list_clear (&uzbl.filter->allow);
+    list_clear (&uzbl.filter->block);
+    g_ptr_array_set_size (uzbl.filter->rewrites, 0);
+}
+
+static gchar *
+reverse_host (const gchar *host, gsize len);
+static gint
+compare_hosts (gconstpointer a, gconstpointer b);
+static gboolean
+host_is_within (const gchar *host, const gchar *domain);
+
+gboolean
+uzbl_filter_compile (const gchar *source, const gchar *path)
+{
+    gchar *contents;
+    GError *err = NULL;
+    guint i;
+
+    if (!g_file_get_contents (source, &contents, NULL, NULL)) {
+        return FALSE;
+    }
+
+    GPtrArray *hosts = g_ptr_array_new_with_free_func (g_free);
+
+    /* Take the last word of each line so that hosts files work as well. */
+    gchar *line = contents;
+    while (line) {
+        gchar *next = strchr (line, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+
+        g_strstrip (line);
+        if (*line && *line != '#') {
+            const gchar *host = line + strcspn (line, " \t");
+            while (*host) {
+                line = (gchar *)host + strspn (host, " \t");
+                host = line + strcspn (line, " \t");
+            }
+
+            if (*line == '.') {
+                ++line;
+            }
+            if (*line) {
+                gchar *lower = g_ascii_strdown (line, -1);
+                g_ptr_array_add (hosts, reverse_host (lower, strlen (lower)));
+                g_free (lower);
+            }
+        }
+
+        line = next;
+    }
+
+    g_free (contents);
+
+    g_ptr_array_sort (hosts, compare_hosts);
+
+    GByteArray *data = g_byte_array_new ();
+    GString *strings = g_string_new ("");
+    guint32 header[2] = { 0, 0 };
+    const gchar *last = NULL;
+    guint32 count = 0;
+
+    g_byte_array_append (data, (const guint8 *)HOST_MAP_MAGIC, strlen (HOST_MAP_MAGIC));
+    g_byte_array_append (data, (const guint8 *)header, sizeof (header));
+
+    /* Drop duplicates and subdomains of hosts which are already listed;
+     * they sort directly after their parent. */
+    for (i = 0; i < hosts->len; ++i) {
+        const gchar *host = g_ptr_array_index (hosts, i);
+
+        if (last && host_is_within (host, last)) {
+            continue;
+        }
+
+        guint32 offset = GUINT32_TO_LE (strings->len);
+        g_byte_array_append (data, (const guint8 *)&offset, sizeof (offset));
+        g_string_append_len (strings, host, strlen (host) + 1);
+
+        last = host;
+        ++count;
+    }
+
+    header[0] = GUINT32_TO_LE (count);
+    memcpy (data->data + strlen (HOST_MAP_MAGIC), header, sizeof (header));
+    g_byte_array_append (data, (const guint8 *)strings->str, strings->len);
+
+    /* The file is replaced by a rename, so instances which have the old one
+     * mapped are unaffected. */
+    gboolean ok = g_file_set_contents (path, (const gchar *)data->data, data->len, &err);
+    if (!ok) {
+        uzbl_debug ("Failed to write host list %s: %s\n", path, err->message);
+        g_error_free (err);
+    }
+
+    g_string_free (strings, TRUE);
+    g_byte_array_free (data, TRUE);
+    g_ptr_array_free (hosts, TRUE);
+
+    return ok;
+}
+
+static UzblHostMap *
+host_map_new (const gchar *path);
+static void
+free_host_map (UzblHostMap *map);
+
+gboolean
+uzbl_filter_map (const gchar *action, const gchar *path)
+{
+    UzblFilterList *list;
+
+    if (!g_strcmp0 (action, "allow")) {
+        list = &uzbl.filter->allow;
+    } else if (!g_strcmp0 (action, "block")) {
+        list = &uzbl.filter->block;
+    } else {
+        return FALSE;
+    }
+
+    UzblHostMap *map = host_map_new (path);
+
+    if (!map) {
+        return FALSE;
+    }
+
+    if (list->map) {
+        free_host_map (list->map);
+    }
+    list->map = map;
+
+    return TRUE;
+}
+
+static gchar *
+uri_host (const gchar *uri);
+static gboolean
+list_match (UzblFilterList *list, const gchar *uri, const gchar *host);
+
+UzblFilterAction
+uzbl_filter_check (const gchar *uri, gchar **rewrite)
+{
+    UzblFilterAction action = UZBL_FILTER_PASS;
+    gchar *host = NULL;
+    guint i;
+
+    if (g_hash_table_size (uzbl.filter->allow.hosts) || uzbl.filter->allow.map ||
+        g_hash_table_size (uzbl.filter->block.hosts) || uzbl.filter->block.map) {
+        host = uri_host (uri);
+    }
+
+    if (list_match (&uzbl.filter->allow, uri, host)) {
+        action = UZBL_FILTER_ALLOW;
+    } else if (list_match (&uzbl.filter->block, uri, host)) {
+        action = UZBL_FILTER_BLOCK;
+        *rewrite = g_strdup ("about:blank");
+    } else {
+        for (i = 0; i < uzbl.filter->rewrites->len; ++i) {
+            UzblFilterRewrite *rw = g_ptr_array_index (uzbl.filter->rewrites, i);
+
+            if (g_regex_match (rw->regex, uri, 0, NULL)) {
+                *rewrite = g_regex_replace (rw->regex, uri, -1, 0, rw->replacement, 0, NULL);
+                if (*rewrite) {
+                    action = UZBL_FILTER_REWRITE;
+                }
+                break;
+            }
+        }
+    }
+
+    g_free (host);
+
+    return action;
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+static void
+free_substrings (UzblSubstrings *ac);
+
+void
+list_init (UzblFilterList *list)
+{
+    list->hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    list->substrings = g_ptr_array_new_with_free_func (g_free);
+    list->patterns = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+    list->map = NULL;
+
+    list->dirty = FALSE;
+    list->matcher = NULL;
+    list->regex = NULL;
+}
+
+void
+list_free (UzblFilterList *list)
+{
+    list_clear (list);
+
+    g_hash_table_destroy (list->hosts);
+    g_ptr_array_free (list->substrings, TRUE);
+    g_ptr_array_free (list->patterns, TRUE);
+}
+
+void
+free_rewrite (gpointer data)
+{
+    UzblFilterRewrite *rw = (UzblFilterRewrite *)data;
+
+    g_regex_unref (rw->regex);
+    g_free (rw->replacement);
+    g_free (rw);
+}
+
+static GRegex *
+compile_regex (const gchar *pattern, GRegexCompileFlags flags);
+
+gboolean
+list_add (UzblFilterList *list, const gchar *kind, const gchar *pattern)
+{
+    if (!g_strcmp0 (kind, "host")) {
+        /* "example.com" and ".example.com" mean the same thing. */
+        if (*pattern == '.') {
+            ++pattern;
+        }
+
+        g_hash_table_add (list->hosts, g_ascii_strdown (pattern, -1));
+
+        return TRUE;
+    }
+
+    if (!g_strcmp0 (kind, "url")) {
+        g_ptr_array_add (list->substrings, g_strdup (pattern));
+    } else if (!g_strcmp0 (kind, "regex")) {
+        /* Only checked here; matching uses the combined expression. */
+        GRegex *regex = compile_regex (pattern, 0);
+
+        if (!regex) {
+            return FALSE;
+        }
+
+        g_ptr_array_add (list->patterns, regex);
+    } else {
+        return FALSE;
+    }
+
+    list->dirty = TRUE;
+
+    return TRUE;
+}
+
+gboolean
+add_rewrite (const gchar *pattern, const gchar *replacement)
+{
+    GRegex *regex = compile_regex (pattern, G_REGEX_OPTIMIZE);
+
+    if (!regex) {
+        return FALSE;
+    }
+
+    UzblFilterRewrite *rw = g_malloc (sizeof (UzblFilterRewrite));
+
+    rw->regex = regex;
+    rw->replacement = g_strdup (replacement);
+
+    g_ptr_array_add (uzbl.filter->rewrites, rw);
+
+    return TRUE;
+}
+
+void
+list_clear (UzblFilterList *list)
+{
+    g_hash_table_remove_all (list->hosts);
+    g_ptr_array_set_size (list->substrings, 0);
+    g_ptr_array_set_size (list->patterns, 0);
+
+    if (list->matcher) {
+        free_substrings (list->matcher);
+        list->matcher = NULL;
+    }
+    if (list->regex) {
+        g_regex_unref (list->regex);
+        list->regex = NULL;
+    }
+    if (list->map) {
+        free_host_map (list->map);
+        list->map = NULL;
+    }
+
+    list->dirty = FALSE;
+}
+
+gchar *
+reverse_host (const gchar *host, gsize len)
+{
+    gchar *reversed = g_malloc (len + 1);
+    gsize i;
+
+    for (i = 0; i < len; ++i) {
+        gchar c = host[len - 1 - i];
+
+        reversed[i] = (c == '.') ? HOST_SEPARATOR : c;
+    }
+    reversed[len] = '\0';
+
+    return reversed;
+}
+
+gint
+compare_hosts (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*(const gchar **)a, *(const gchar **)b);
+}
+
+gboolean
+host_is_within (const gchar *host, const gchar *domain)
+{
+    gsize len = strlen (domain);
+
+    return !strncmp (host, domain, len) &&
+        (host[len] == '\0' || host[len] == HOST_SEPARATOR);
+}
+
+UzblHostMap *
+host_map_new (const gchar *path)
+{
+    GError *err = NULL;
+    GMappedFile *file = g_mapped_file_new (path, FALSE, &err);
+
+    if (!file) {
+        uzbl_debug ("Failed to map host list %s: %s\n", path, err->message);
+        g_error_free (err);
+        return NULL;
+    }
+
+    const gchar *contents = g_mapped_file_get_contents (file);
+    gsize len = g_mapped_file_get_length (file);
+    guint32 count = 0;
+
+    /* Only the layout is checked here; offsets are checked as they are
+     * used so that mapping stays cheap for large lists. */
+    if (len >= HOST_MAP_HEADER_SIZE && !memcmp (contents, HOST_MAP_MAGIC, strlen (HOST_MAP_MAGIC))) {
+        memcpy (&count, contents + strlen (HOST_MAP_MAGIC), sizeof (count));
+        count = GUINT32_FROM_LE (count);
+    }
+
+    gsize strings_start = HOST_MAP_HEADER_SIZE + (gsize)count * sizeof (guint32);
+
+    if (!count || len <= strings_start || contents[len - 1] != '\0') {
+        uzbl_debug ("Invalid host list: %s\n", path);
+        g_mapped_file_unref (file);
+        return NULL;
+    }
+
+    UzblHostMap *map = g_malloc (sizeof (UzblHostMap));
+
+    map->file = file;
+    map->offsets = (const guint32 *)(contents + HOST_MAP_HEADER_SIZE);
+    map->count = count;
+    map->strings = contents + strings_start;
+    map->strings_len = len - strings_start;
+
+    return map;
+}
+
+void
+free_host_map (UzblHostMap *map)
+{
+    g_mapped_file_unref (map->file);
+    g_free (map);
+}
+
+static const gchar *
+host_map_entry (const UzblHostMap *map, guint32 i);
+static gboolean
+host_map_match (const UzblHostMap *map, const gchar *host);
+
+const gchar *
+host_map_entry (const UzblHostMap *map, guint32 i)
+{
+    guint32 offset = GUINT32_FROM_LE (map->offsets[i]);
+
+    if (offset >= map->strings_len) {
+        return NULL;
+    }
+
+    return map->strings + offset;
+}
+
+gboolean
+host_map_match (const UzblHostMap *map, const gchar *host)
+{
+    gchar *key = reverse_host (host, strlen (host));
+    const gchar *entry = NULL;
+    guint32 lo = 0;
+    guint32 hi = map->count;
+
+    /* Find the last entry at or before the key. */
+    while (lo < hi) {
+        guint32 mid = lo + (hi - lo) / 2;
+        const gchar *candidate = host_map_entry (map, mid);
+
+        if (!candidate) {
+            break;
+        }
+
+        if (strcmp (candidate, key) <= 0) {
+            entry = candidate;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    gboolean match = entry && host_is_within (key, entry);
+
+    g_free (key);
+
+    return match;
+}
+
+gchar *
+uri_host (const gchar *uri)
+{
+    const gchar *start = strstr (uri, "://");
+
+    if (!start) {
+        return NULL;
+    }
+
+    start += strlen ("://");
+
+    gsize len = strcspn (start, "/?#");
+
+    /* Skip any user information. */
+    const gchar *at = memchr (start, '@', len);
+    if (at) {
+        len -= at + 1 - start;
+        start = at + 1;
+    }
+
+    /* Drop the port, keeping the brackets of IPv6 literals. */
+    if (*start == '[') {
+        const gchar *end = memchr (start, ']', len);
+        if (end) {
+            len = end + 1 - start;
+        }
+    } else {
+        const gchar *port = memchr (start, ':', len);
+        if (port) {
+            len = port - start;
+        }
+    }
+
+    return g_ascii_strdown (start, len);
+}
+
+static gboolean
+host_match (const UzblFilterList *list, const gchar *host);
+static void
+list_compile (UzblFilterList *list);
+static gboolean
+substrings_match (const UzblSubstrings *ac, const gchar *text);
+
+gboolean
+list_match (UzblFilterList *list, const gchar *uri, const gchar *host)
+{
+    guint i;
+
+    if (host_match (list, host)) {
+        return TRUE;
+    }
+
+    if (list->dirty) {
+        list_compile (list);
+    }
+
+    if (list->matcher && substrings_match (list->matcher, uri)) {
+        return TRUE;
+    }
+
+    if (list->regex) {
+        return g_regex_match (list->regex, uri, 0, NULL);
+    }
+
+    /* The patterns could not be combined; try them one at a time. */
+    for (i = 0; i < list->patterns->len; ++i) {
+        if (g_regex_match (g_ptr_array_index (list->patterns, i), uri, 0, NULL)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+GRegex *
+compile_regex (const gchar *pattern, GRegexCompileFlags flags)
+{
+    GError *err = NULL;
+    GRegex *regex = g_regex_new (pattern, flags, 0, &err);
+
+    if (!regex) {
+        uzbl_debug ("Invalid filter pattern %s: %s\n", pattern, err->message);
+        g_error_free (err);
+    }
+
+    return regex;
+}
+
+gboolean
+host_match (const UzblFilterList *list, const gchar *host)
+{
+    const gchar *suffix = host;
+
+    if (!host) {
+        return FALSE;
+    }
+
+    if (list->map && host_map_match (list->map, host)) {
+        return TRUE;
+    }
+
+    if (!g_hash_table_size (list->hosts)) {
+        return FALSE;
+    }
+
+    /* Check the host and then each parent domain. */
+    while (suffix) {
+        if (g_hash_table_contains (list->hosts, suffix)) {
+            return TRUE;
+        }
+
+        suffix = strchr (suffix, '.');
+        if (suffix) {
+            ++suffix;
+        }
+    }
+
+    return FALSE;
+}
+
+static UzblSubstrings *
+substrings_new (const GPtrArray *sources);
+
+void
+list_compile (UzblFilterList *list)
+{
+    guint i;
+
+    if (list->matcher) {
+        free_substrings (list->matcher);
+        list->matcher = NULL;
+    }
+    if (list->regex) {
+        g_regex_unref (list->regex);
+        list->regex = NULL;
+    }
+
+    if (list->substrings->len) {
+        list->matcher = substrings_new (list->substrings);
+    }
+
+    if (list->patterns->len) {
+        GString *combined = g_string_new ("");
+        GError *err = NULL;
+
+        /* A single alternation is matched in one pass instead of one pass
+         * per pattern. */
+        for (i = 0; i < list->patterns->len; ++i) {
+            GRegex *regex = g_ptr_array_index (list->patterns, i);
+
+            g_string_append_printf (combined, "%s(?:%s)",
+                i ? "|" : "", g_regex_get_pattern (regex));
+        }
+
+        list->regex = g_regex_new (combined->str, G_REGEX_OPTIMIZE, 0, &err);
+        if (!list->regex) {
+            uzbl_debug ("Failed to combine filter patterns: %s\n", err->message);
+            g_error_free (err);
+        }
+
+        g_string_free (combined, TRUE);
+    }
+
+    list->dirty = FALSE;
+}
+
+static guint
+substrings_next (const UzblSubstrings *ac, guint state, guchar byte);
+
+UzblSubstrings *
+substrings_new (const GPtrArray *sources)
+{
+    UzblSubstrings *ac = g_malloc (sizeof (UzblSubstrings));
+    UzblSubstringState root = { 0, 0, 0, 0, FALSE };
+    UzblSubstringState *states;
+    guint max_depth = 0;
+    guint i;
+
+    ac->edges = g_hash_table_new (g_direct_hash, g_direct_equal);
+    ac->states = g_array_new (FALSE, FALSE, sizeof (UzblSubstringState));
+    g_array_append_val (ac->states, root);
+
+    /* Build the trie. */
+    for (i = 0; i < sources->len; ++i) {
+        const guchar *p = g_ptr_array_index (sources, i);
+        guint state = 0;
+        guint depth = 0;
+
+        for (; *p; ++p) {
+            guint next = substrings_next (ac, state, *p);
+
+            ++depth;
+
+            if (!next) {
+                UzblSubstringState child = { state, depth, 0, *p, FALSE };
+
+                next = ac->states->len;
+                g_array_append_val (ac->states, child);
+                g_hash_table_insert (ac->edges, EDGE_KEY (state, *p), GUINT_TO_POINTER (next));
+            }
+
+            state = next;
+        }
+
+        g_array_index (ac->states, UzblSubstringState, state).match = TRUE;
+        max_depth = MAX (max_depth, depth);
+    }
+
+    states = (UzblSubstringState *)ac->states->data;
+
+    /* Order the states by depth so that failure links only ever point at
+     * states which are already done. */
+    guint n = ac->states->len;
+    guint *start = g_new0 (guint, max_depth + 2);
+    guint *order = g_new (guint, n);
+
+    for (i = 0; i < n; ++i) {
+        ++start[states[i].depth + 1];
+    }
+    for (i = 1; i <= max_depth + 1; ++i) {
+        start[i] += start[i - 1];
+    }
+    for (i = 0; i < n; ++i) {
+        order[start[states[i].depth]++] = i;
+    }
+
+    /* order[0] is the root. */
+    for (i = 1; i < n; ++i) {
+        UzblSubstringState *state = &states[order[i]];
+        guint fail = 0;
+
+        if (state->parent) {
+            fail = states[state->parent].fail;
+            while (fail && !substrings_next (ac, fail, state->byte)) {
+                fail = states[fail].fail;
+            }
+            fail = substrings_next (ac, fail, state->byte);
+        }
+
+        state->fail = fail;
+        state->match |= states[fail].match;
+    }
+
+    g_free (start);
+    g_free (order);
+
+    return ac;
+}
+
+void
+free_substrings (UzblSubstrings *ac)
+{
+    g_hash_table_destroy (ac->edges);
+    g_array_free (ac->states, TRUE);
+    g_free (ac);
+}
+
+gboolean
+substrings_match (const UzblSubstrings *ac, const gchar *text)
+{
+    const UzblSubstringState *states = (const UzblSubstringState *)ac->states->data;
+    const guchar *p;
+    guint state = 0;
+
+    for (p = (const guchar *)text; *p; ++p) {
+        guint next;
+
+        while (!(next = substrings_next (ac, state, *p)) && state) {
+            state = states[state].fail;
+        }
+
+        state = next;
+
+        if (states[state].match) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+guint
+substrings_next (const UzblSubstrings *ac, guint state, guchar byte)
+{
+    return GPOINTER_TO_UINT (g_hash_table_lookup (ac->edges, EDGE_KEY (state, byte)));
+}
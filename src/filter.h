@@ -0,0 +1,40 @@
+#ifndef UZBL_FILTER_H
+#define UZBL_FILTER_H
+
+#include <glib.h>
+
+typedef enum {
+    /* No rule matched; ask the request handler. */
+    UZBL_FILTER_PASS,
+    UZBL_FILTER_ALLOW,
+    UZBL_FILTER_BLOCK,
+    UZBL_FILTER_REWRITE
+} UzblFilterAction;
+
+void
+uzbl_filter_init ();
+void
+uzbl_filter_free ();
+
+/* Rules look like "<allow|block> <host|url|regex> <PATTERN>" or
+ * "rewrite regex <PATTERN> <REPLACEMENT>". */
+gboolean
+uzbl_filter_add (const gchar *rule);
+gboolean
+uzbl_filter_load (const gchar *path);
+void
+uzbl_filter_clear ();
+
+/* Host lists can be compiled into a file which is mapped instead of parsed.
+ * Loading one is cheap and every instance shares its pages. Mapping a list
+ * replaces the previous one for that action only once it proved valid. */
+gboolean
+uzbl_filter_compile (const gchar *source, const gchar *path);
+gboolean
+uzbl_filter_map (const gchar *action, const gchar *path);
+
+/* If the request should go elsewhere, the new URI is stored in rewrite. */
+UzblFilterAction
+uzbl_filter_check (const gchar *uri, gchar **rewrite);
+
+#endif
@@ -2,8 +2,10 @@
 
 #include "commands.h"
 #include "events.h"
+#include "filter.h"
 #include "io.h"
 #include "menu.h"
+#include "soup.h"
 #include "status-bar.h"
 #include "type.h"
 #include "util.h"
@@ -44,6 +46,38 @@ struct _UzblGui {
 
     GdkEventButton *last_button;
     WebKitWebView *tmp_web_view;
+
+    /* Compiled status bar and title formats. */
+    UzblTemplate *status_left_template;
+    UzblTemplate *status_right_template;
+    UzblTemplate *title_template;
+
+    /* What needs to be rendered again and the pending (rate limited)
+     * update. */
+    guint dirty;
+    guint update_source;
+    gint64 last_update;
+
+    /* Handler decisions which may be reused, most recently used first. The
+     * table maps keys to links in the queue. */
+    GHashTable *decisions;
+    GQueue decision_order;
+    guint64 decision_hits;
+    guint64 decision_misses;
+};
+
+/* A handler result which the handler allowed to be reused. */
+typedef struct {
+    gchar *key;
+    gchar *result;
+    gint64 expires;
+} UzblCachedDecision;
+
+enum {
+    UZBL_GUI_DIRTY_STATUS_LEFT  = 1 << 0,
+    UZBL_GUI_DIRTY_STATUS_RIGHT = 1 << 1,
+    UZBL_GUI_DIRTY_TITLE        = 1 << 2,
+    UZBL_GUI_DIRTY_ALL          = (1 << 3) - 1
 };
 
 /* =========================== PUBLIC API =========================== */
@@ -67,6 +101,9 @@ uzbl_gui_init ()
 {
     uzbl.gui_ = g_malloc0 (sizeof (UzblGui));
 
+    uzbl.gui_->decisions = g_hash_table_new (g_str_hash, g_str_equal);
+    g_queue_init (&uzbl.gui_->decision_order);
+
     status_bar_init ();
     web_view_init ();
     vbox_init ();
@@ -101,14 +138,139 @@ uzbl_gui_free ()
         g_object_unref (uzbl.gui_->tmp_web_view);
     }
 
+    if (uzbl.gui_->update_source) {
+        g_source_remove (uzbl.gui_->update_source);
+    }
+
+    uzbl_variables_template_free (uzbl.gui_->status_left_template);
+    uzbl_variables_template_free (uzbl.gui_->status_right_template);
+    uzbl_variables_template_free (uzbl.gui_->title_template);
+
+    uzbl_gui_decision_cache_clear ();
+    g_hash_table_destroy (uzbl.gui_->decisions);
+
     g_free (uzbl.gui_);
     uzbl.gui_ = NULL;
 }
 
+static void
+schedule_update ();
+
 void
 uzbl_gui_update_title ()
 {
+    if (!uzbl.gui_) {
+        return;
+    }
+
+    uzbl.gui_->dirty |= UZBL_GUI_DIRTY_ALL;
+    schedule_update ();
+}
+
+void
+uzbl_gui_update_variable (const gchar *name)
+{
+    if (!uzbl.gui_) {
+        return;
+    }
+
+    if (!g_strcmp0 (name, "show_status")) {
+        /* Switches between the title formats. */
+        uzbl.gui_->dirty |= UZBL_GUI_DIRTY_ALL;
+    } else if (!g_strcmp0 (name, "status_format")) {
+        uzbl.gui_->dirty |= UZBL_GUI_DIRTY_STATUS_LEFT;
+    } else if (!g_strcmp0 (name, "status_format_right")) {
+        uzbl.gui_->dirty |= UZBL_GUI_DIRTY_STATUS_RIGHT;
+    } else if (!g_strcmp0 (name, "title_format_short") ||
+               !g_strcmp0 (name, "title_format_long")) {
+        uzbl.gui_->dirty |= UZBL_GUI_DIRTY_TITLE;
+    } else {
+        if (uzbl_variables_template_uses (uzbl.gui_->status_left_template, name)) {
+            uzbl.gui_->dirty |= UZBL_GUI_DIRTY_STATUS_LEFT;
+        }
+        if (uzbl_variables_template_uses (uzbl.gui_->status_right_template, name)) {
+            uzbl.gui_->dirty |= UZBL_GUI_DIRTY_STATUS_RIGHT;
+        }
+        if (uzbl_variables_template_uses (uzbl.gui_->title_template, name)) {
+            uzbl.gui_->dirty |= UZBL_GUI_DIRTY_TITLE;
+        }
+    }
+
+    if (uzbl.gui_->dirty) {
+        schedule_update ();
+    }
+}
+
+void
+uzbl_gui_decision_cache_stats (GString *result)
+{
+    if (!uzbl.gui_) {
+        return;
+    }
+
+    g_string_append_printf (result,
+        "{\"entries\": %u, "
+        "\"hits\": %" G_GUINT64_FORMAT ", "
+        "\"misses\": %" G_GUINT64_FORMAT "}",
+        g_queue_get_length (&uzbl.gui_->decision_order),
+        uzbl.gui_->decision_hits,
+        uzbl.gui_->decision_misses);
+}
+
+static void
+drop_decision (GList *link);
+
+void
+uzbl_gui_decision_cache_clear ()
+{
+    if (!uzbl.gui_) {
+        return;
+    }
+
+    while (!g_queue_is_empty (&uzbl.gui_->decision_order)) {
+        drop_decision (g_queue_peek_tail_link (&uzbl.gui_->decision_order));
+    }
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+/* At most one update per frame. */
+#define UZBL_GUI_FRAME_INTERVAL (G_USEC_PER_SEC / 60)
+
+static gboolean
+update_title_cb (gpointer data);
+
+void
+schedule_update ()
+{
+    gint64 elapsed;
+    guint delay = 0;
+
+    if (uzbl.gui_->update_source) {
+        return;
+    }
+
+    elapsed = g_get_monotonic_time () - uzbl.gui_->last_update;
+    if (elapsed < UZBL_GUI_FRAME_INTERVAL) {
+        delay = (UZBL_GUI_FRAME_INTERVAL - elapsed) / 1000;
+    }
+
+    /* Run ahead of the redraw so the new text is drawn in the same frame. */
+    uzbl.gui_->update_source = g_timeout_add_full (G_PRIORITY_HIGH_IDLE, delay,
+                                                   update_title_cb, NULL, NULL);
+}
+
+gboolean
+update_title_cb (gpointer data)
+{
+    UZBL_UNUSED (data);
+
     const gchar *format = NULL;
+    guint dirty = uzbl.gui_->dirty;
+
+    uzbl.gui_->update_source = 0;
+    uzbl.gui_->last_update = g_get_monotonic_time ();
+    uzbl.gui_->dirty = 0;
 
     /* Update the status bar if shown. */
     if (uzbl_variables_get_int ("show_status")) {
@@ -117,28 +279,36 @@ uzbl_gui_update_title ()
         gchar *status_format;
         gchar *parsed;
 
-        status_format = uzbl_variables_get_string ("status_format");
-        parsed = uzbl_variables_expand (status_format);
-        uzbl_status_bar_update_left (uzbl.gui.status_bar, parsed);
-        g_free (status_format);
-        g_free (parsed);
+        if (dirty & UZBL_GUI_DIRTY_STATUS_LEFT) {
+            status_format = uzbl_variables_get_string ("status_format");
+            parsed = uzbl_variables_expand_template (&uzbl.gui_->status_left_template, status_format);
+            uzbl_status_bar_update_left (uzbl.gui.status_bar, parsed);
+            g_free (status_format);
+            g_free (parsed);
+        }
 
-        status_format = uzbl_variables_get_string ("status_format_right");
-        parsed = uzbl_variables_expand (status_format);
-        uzbl_status_bar_update_right (uzbl.gui.status_bar, parsed);
-        g_free (status_format);
-        g_free (parsed);
+        if (dirty & UZBL_GUI_DIRTY_STATUS_RIGHT) {
+            status_format = uzbl_variables_get_string ("status_format_right");
+            parsed = uzbl_variables_expand_template (&uzbl.gui_->status_right_template, status_format);
+            uzbl_status_bar_update_right (uzbl.gui.status_bar, parsed);
+            g_free (status_format);
+            g_free (parsed);
+        }
     } else {
         format = "title_format_long";
     }
 
+    if (!(dirty & UZBL_GUI_DIRTY_TITLE)) {
+        return FALSE;
+    }
+
     gchar *title_format = uzbl_variables_get_string (format);
 
     /* Update window title. */
     /* If we're starting up or shutting down there might not be a window yet. */
     gboolean have_main_window = !uzbl.state.plug_mode && GTK_IS_WINDOW (uzbl.gui.main_window);
     if (title_format && have_main_window) {
-        gchar *parsed = uzbl_variables_expand (title_format);
+        gchar *parsed = uzbl_variables_expand_template (&uzbl.gui_->title_template, title_format);
         const gchar *current_title = gtk_window_get_title (GTK_WINDOW (uzbl.gui.main_window));
         /* XMonad hogs CPU if the window title updates too frequently, so we
          * don't set it unless we need to. */
@@ -148,9 +318,9 @@ uzbl_gui_update_title ()
     }
 
     g_free (title_format);
-}
 
-/* ===================== HELPER IMPLEMENTATIONS ===================== */
+    return FALSE;
+}
 
 static gboolean
 key_press_cb (GtkWidget *widget, GdkEventKey *event, gpointer data);
@@ -416,7 +586,7 @@ key_press_cb (GtkWidget *widget, GdkEventKey *event, gpointer data)
         send_keypress_event (event);
     }
 
-    return !uzbl_variables_get_int ("forward_keys");
+    return !uzbl_variables_get_int_id (UZBL_VARIABLE_FORWARD_KEYS);
 }
 
 gboolean
@@ -429,7 +599,7 @@ key_release_cb (GtkWidget *widget, GdkEventKey *event, gpointer data)
         send_keypress_event (event);
     }
 
-    return !uzbl_variables_get_int ("forward_keys");
+    return !uzbl_variables_get_int_id (UZBL_VARIABLE_FORWARD_KEYS);
 }
 
 /* Web view callbacks */
@@ -493,7 +663,7 @@ button_press_cb (GtkWidget *widget, GdkEventButton *event, gpointer data)
     }
 
     if ((event->type == GDK_2BUTTON_PRESS) || (event->type == GDK_3BUTTON_PRESS)) {
-        gboolean handle_multi_button = uzbl_variables_get_int ("handle_multi_button");
+        gboolean handle_multi_button = uzbl_variables_get_int_id (UZBL_VARIABLE_HANDLE_MULTI_BUTTON);
 
         if ((event->button == 1) && !is_editable && is_document) {
             sendev    = TRUE;
@@ -558,6 +728,12 @@ link_hover_cb (WebKitWebView *view, const gchar *title, const gchar *link, gpoin
     UZBL_UNUSED (data);
 
     send_hover_event (link, title);
+
+    /* The link is likely to be followed soon. */
+    if (link && uzbl_variables_get_int_id (UZBL_VARIABLE_PREFETCH_ON_HOVER) &&
+        uzbl_variables_get_int ("enable_dns_prefetch")) {
+        uzbl_soup_prefetch (link);
+    }
 }
 
 /* Page metadata events */
@@ -573,7 +749,7 @@ title_change_cb (WebKitWebView *view, GParamSpec param_spec, gpointer data)
     g_free (uzbl.gui.main_title);
     uzbl.gui.main_title = g_strdup (title ? title : "(no title)");
 
-    uzbl_gui_update_title ();
+    uzbl_gui_update_variable ("TITLE");
 
     uzbl_events_send (TITLE_CHANGED, NULL,
         TYPE_STR, uzbl.gui.main_title,
@@ -608,6 +784,8 @@ uri_change_cb (WebKitWebView *view, GParamSpec param_spec, gpointer data)
         "uri", &uzbl.state.uri,
         NULL);
 
+    uzbl_gui_update_variable ("uri");
+
     /* TODO: Collect all environment settings into one place. */
     g_setenv ("UZBL_URI", uzbl.state.uri, TRUE);
     set_window_property ("UZBL_URI", uzbl.state.uri);
@@ -943,14 +1121,14 @@ run_file_chooser_cb (WebKitWebView *view, WebKitFileChooserRequest *request, gpo
     UZBL_UNUSED (view);
     UZBL_UNUSED (data);
 
-    gchar *handler = uzbl_variables_get_string ("file_chooser_handler");
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_FILE_CHOOSER_HANDLER);
 
     if (!handler || !*handler) {
         return FALSE;
     }
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *file_chooser_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *file_chooser_command = uzbl_commands_parse_cached (handler, args);
 
     if (file_chooser_command) {
         gboolean multiple = webkit_file_chooser_request_get_select_multiple (request);
@@ -1281,17 +1459,28 @@ send_hover_event (const gchar *uri, const gchar *title)
             NULL);
     }
 
-    uzbl_gui_update_title ();
+    uzbl_gui_update_variable ("SELECTED_URI");
 }
 
 static void
 decide_navigation (GString *result, gpointer data);
+static gchar *
+decision_key (const gchar *handler, const GArray *args);
+static const gchar *
+cached_decision (const gchar *key);
+static void
+decide_navigation_cached (GString *result, gpointer data);
+
+typedef struct {
+    WebKitWebPolicyDecision *decision;
+    gchar *key;
+} UzblPendingNavigation;
 
 gboolean
 navigation_decision (WebKitWebPolicyDecision *decision, const gchar *uri, const gchar *src_frame,
         const gchar *dest_frame, const gchar *type, guint button, guint modifiers, gboolean is_gesture)
 {
-    if (uzbl_variables_get_int ("frozen")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_FROZEN)) {
         make_policy (decision, ignore);
         return TRUE;
     }
@@ -1305,10 +1494,10 @@ navigation_decision (WebKitWebPolicyDecision *decision, const gchar *uri, const
         TYPE_STR, type,
         NULL);
 
-    gchar *handler = uzbl_variables_get_string ("navigation_handler");
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_NAVIGATION_HANDLER);
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *scheme_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *scheme_command = uzbl_commands_parse_cached (handler, args);
 
     if (scheme_command) {
         uzbl_commands_args_append (args, g_strdup (uri));
@@ -1319,7 +1508,26 @@ navigation_decision (WebKitWebPolicyDecision *decision, const gchar *uri, const
         uzbl_commands_args_append (args, get_modifier_mask (modifiers));
         uzbl_commands_args_append (args, g_strdup (is_gesture ? "true" : "false"));
         g_object_ref (decision);
-        uzbl_io_schedule_command (scheme_command, args, decide_navigation, decision);
+
+        gchar *key = decision_key (handler, args);
+        const gchar *cached = cached_decision (key);
+
+        if (cached) {
+            GString *res = g_string_new (cached);
+
+            decide_navigation (res, decision);
+
+            g_string_free (res, TRUE);
+            g_free (key);
+            uzbl_commands_args_free (args);
+        } else {
+            UzblPendingNavigation *pending = g_malloc (sizeof (UzblPendingNavigation));
+
+            pending->decision = decision;
+            pending->key = key;
+
+            uzbl_io_schedule_command (scheme_command, args, decide_navigation_cached, pending);
+        }
     } else {
         make_policy (decision, use);
         uzbl_commands_args_free (args);
@@ -1332,6 +1540,24 @@ navigation_decision (WebKitWebPolicyDecision *decision, const gchar *uri, const
 
 static void
 rewrite_request (GString *result, gpointer data);
+static void
+cache_decision (const gchar *key, GString *result);
+static void
+start_request_decision (SoupSession *session, SoupMessage *msg, gpointer data);
+static void
+free_pending_request (gpointer data);
+
+typedef struct {
+    const UzblCommand *command;
+    GArray *args;
+    gchar *key;
+
+    /* Set once the message is queued. */
+    SoupSession *session;
+    SoupMessage *message;
+    gulong finished_handler;
+    gboolean finished;
+} UzblPendingRequest;
 
 gboolean
 request_decision (const gchar *uri, gpointer data)
@@ -1342,10 +1568,25 @@ request_decision (const gchar *uri, gpointer data)
         TYPE_STR, uri,
         NULL);
 
-    gchar *handler = uzbl_variables_get_string ("request_handler");
+    UzblRequestDecision *decision = (UzblRequestDecision *)data;
+    gchar *rewritten = NULL;
+
+    /* Requests which the built-in filter decides never reach the handler. */
+    if (uzbl_filter_check (uri, &rewritten) != UZBL_FILTER_PASS) {
+        GString *res = g_string_new (rewritten);
+
+        rewrite_request (res, (gpointer)decision->request);
+
+        g_string_free (res, TRUE);
+        g_free (rewritten);
+
+        return TRUE;
+    }
+
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_REQUEST_HANDLER);
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *request_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *request_command = uzbl_commands_parse_cached (handler, args);
 
     if (request_command) {
         const gchar *can_display = "unknown";
@@ -1353,20 +1594,42 @@ request_decision (const gchar *uri, gpointer data)
         uzbl_commands_args_append (args, g_strdup (uri));
         uzbl_commands_args_append (args, g_strdup (can_display));
 
-        UzblRequestDecision *decision = (UzblRequestDecision *)data;
-
         uzbl_commands_args_append (args, g_strdup (decision->frame));
         uzbl_commands_args_append (args, g_strdup (decision->redirect ? "true" : "false"));
 
-        GString *res = g_string_new ("");
+        gchar *key = decision_key (handler, args);
+        const gchar *cached = cached_decision (key);
+        SoupMessage *message = webkit_network_request_get_message (decision->request);
 
-        uzbl_commands_run_parsed (request_command, args, res);
-        uzbl_commands_args_free (args);
+        if (!cached && message && !decision->redirect &&
+            uzbl_variables_get_int_id (UZBL_VARIABLE_REQUEST_HANDLER_ASYNC)) {
+            /* Let WebKit carry on loading other resources; this one waits
+             * in the queue until the handler has decided. */
+            UzblPendingRequest *pending = g_malloc0 (sizeof (UzblPendingRequest));
 
-        rewrite_request (res, (gpointer)decision->request);
-        g_string_free (res, TRUE);
+            pending->command = request_command;
+            pending->args = args;
+            pending->key = key;
+
+            uzbl_soup_hold_message (message, start_request_decision, pending, free_pending_request);
+            g_object_unref (decision->request);
+        } else {
+            GString *res = g_string_new (cached);
+
+            if (!cached) {
+                uzbl_commands_run_parsed (request_command, args, res);
+                cache_decision (key, res);
+            }
+
+            g_free (key);
+            uzbl_commands_args_free (args);
+
+            rewrite_request (res, (gpointer)decision->request);
+            g_string_free (res, TRUE);
+        }
     } else {
         uzbl_commands_args_free (args);
+        g_object_unref (decision->request);
     }
 
     g_free (handler);
@@ -1429,15 +1692,15 @@ send_load_error (const gchar *uri, GError *err)
 gboolean
 mime_decision (WebKitWebPolicyDecision *decision, const gchar *mime_type, const gchar *disposition)
 {
-    if (uzbl_variables_get_int ("frozen")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_FROZEN)) {
         make_policy (decision, ignore);
         return FALSE;
     }
 
-    gchar *handler = uzbl_variables_get_string ("mime_handler");
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_MIME_HANDLER);
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *mime_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *mime_command = uzbl_commands_parse_cached (handler, args);
 
     if (mime_command) {
         uzbl_commands_args_append (args, g_strdup (mime_type));
@@ -1470,6 +1733,10 @@ dom_focus_cb (WebKitDOMEventTarget *target, WebKitDOMEvent *event, gpointer data
     UZBL_UNUSED (target);
     UZBL_UNUSED (data);
 
+    if (!uzbl_events_listening (FOCUS_ELEMENT)) {
+        return;
+    }
+
     WebKitDOMEventTarget *etarget = webkit_dom_event_get_target (event);
     gchar *name = webkit_dom_node_get_node_name (WEBKIT_DOM_NODE (etarget));
 
@@ -1484,6 +1751,10 @@ dom_blur_cb (WebKitDOMEventTarget *target, WebKitDOMEvent *event, gpointer data)
     UZBL_UNUSED (target);
     UZBL_UNUSED (data);
 
+    if (!uzbl_events_listening (BLUR_ELEMENT)) {
+        return;
+    }
+
     WebKitDOMEventTarget *etarget = webkit_dom_event_get_target (event);
     gchar *name = webkit_dom_node_get_node_name (WEBKIT_DOM_NODE (etarget));
 
@@ -1533,7 +1804,7 @@ decide_permission (GString *result, gpointer data);
 gboolean
 request_permission (const gchar *uri, const gchar *type, const gchar *desc, GObject *obj)
 {
-    if (uzbl_variables_get_int ("frozen")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_FROZEN)) {
         if (false) {
         permission_requests (deny_request)
         }
@@ -1542,10 +1813,10 @@ request_permission (const gchar *uri, const gchar *type, const gchar *desc, GObj
 
     uzbl_debug ("Permission requested -> %s\n", uri);
 
-    gchar *handler = uzbl_variables_get_string ("permission_handler");
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_PERMISSION_HANDLER);
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *permission_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *permission_command = uzbl_commands_parse_cached (handler, args);
 
     g_free (handler);
 
@@ -1678,6 +1949,10 @@ choose_file (GString *result, gpointer data)
 void
 send_scroll_event (int type, GtkAdjustment *adjust)
 {
+    if (!uzbl_events_listening (type)) {
+        return;
+    }
+
     gdouble value = gtk_adjustment_get_value (adjust);
     gdouble min = gtk_adjustment_get_lower (adjust);
     gdouble max = gtk_adjustment_get_upper (adjust);
@@ -1722,6 +1997,206 @@ decide_navigation (GString *result, gpointer data)
     g_object_unref (decision);
 }
 
+void
+decide_navigation_cached (GString *result, gpointer data)
+{
+    UzblPendingNavigation *pending = (UzblPendingNavigation *)data;
+
+    cache_decision (pending->key, result);
+    decide_navigation (result, pending->decision);
+
+    g_free (pending->key);
+    g_free (pending);
+}
+
+gchar *
+decision_key (const gchar *handler, const GArray *args)
+{
+    GString *key = g_string_new (handler);
+    guint i;
+
+    for (i = 0; i < args->len; ++i) {
+        g_string_append_c (key, '\n');
+        g_string_append (key, argv_idx (args, i));
+    }
+
+    return g_string_free (key, FALSE);
+}
+
+const gchar *
+cached_decision (const gchar *key)
+{
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_DECISION_CACHE_SIZE) <= 0) {
+        return NULL;
+    }
+
+    GList *link = g_hash_table_lookup (uzbl.gui_->decisions, key);
+    UzblCachedDecision *cached = link ? (UzblCachedDecision *)link->data : NULL;
+
+    if (cached && (cached->expires <= g_get_monotonic_time ())) {
+        drop_decision (link);
+        cached = NULL;
+    }
+
+    if (!cached) {
+        ++uzbl.gui_->decision_misses;
+        return NULL;
+    }
+
+    g_queue_unlink (&uzbl.gui_->decision_order, link);
+    g_queue_push_head_link (&uzbl.gui_->decision_order, link);
+    ++uzbl.gui_->decision_hits;
+
+    return cached->result;
+}
+
+void
+cache_decision (const gchar *key, GString *result)
+{
+    /* Handlers opt in with a first line of "CACHE [SECONDS]". */
+    if (!g_str_has_prefix (result->str, "CACHE")) {
+        return;
+    }
+
+    const gchar *rest = result->str + strlen ("CACHE");
+    gint64 ttl = uzbl_variables_get_int_id (UZBL_VARIABLE_DECISION_CACHE_TTL);
+    gint size = uzbl_variables_get_int_id (UZBL_VARIABLE_DECISION_CACHE_SIZE);
+
+    if (*rest && *rest != ' ' && *rest != '\n') {
+        return;
+    }
+
+    if (*rest == ' ') {
+        gchar *end;
+        gint64 seconds = g_ascii_strtoll (rest + 1, &end, 10);
+
+        if (end != rest + 1) {
+            ttl = seconds;
+        }
+    }
+
+    const gchar *eol = strchr (rest, '\n');
+    g_string_erase (result, 0, eol ? (eol + 1 - result->str) : (gssize)result->len);
+
+    if ((size <= 0) || (ttl <= 0)) {
+        return;
+    }
+
+    GList *link = g_hash_table_lookup (uzbl.gui_->decisions, key);
+    if (link) {
+        drop_decision (link);
+    }
+
+    UzblCachedDecision *cached = g_malloc (sizeof (UzblCachedDecision));
+
+    cached->key = g_strdup (key);
+    cached->result = g_strdup (result->str);
+    cached->expires = g_get_monotonic_time () + ttl * G_TIME_SPAN_SECOND;
+
+    g_queue_push_head (&uzbl.gui_->decision_order, cached);
+    g_hash_table_insert (uzbl.gui_->decisions, cached->key, g_queue_peek_head_link (&uzbl.gui_->decision_order));
+
+    while (g_queue_get_length (&uzbl.gui_->decision_order) > (guint)size) {
+        drop_decision (g_queue_peek_tail_link (&uzbl.gui_->decision_order));
+    }
+}
+
+static void
+request_finished_early (SoupMessage *msg, gpointer data);
+static void
+decide_request (GString *result, gpointer data);
+
+void
+start_request_decision (SoupSession *session, SoupMessage *msg, gpointer data)
+{
+    UzblPendingRequest *pending = (UzblPendingRequest *)data;
+
+    pending->session = g_object_ref (session);
+    pending->message = g_object_ref (msg);
+    pending->finished_handler = g_signal_connect (msg, "finished",
+        G_CALLBACK (request_finished_early), pending);
+
+    /* The arguments belong to the command queue from here on. */
+    uzbl_io_schedule_command (pending->command, pending->args, decide_request, pending);
+    pending->args = NULL;
+}
+
+void
+free_pending_request (gpointer data)
+{
+    UzblPendingRequest *pending = (UzblPendingRequest *)data;
+
+    if (pending->args) {
+        uzbl_commands_args_free (pending->args);
+    }
+    if (pending->message) {
+        g_signal_handler_disconnect (pending->message, pending->finished_handler);
+        g_object_unref (pending->message);
+    }
+    if (pending->session) {
+        g_object_unref (pending->session);
+    }
+
+    g_free (pending->key);
+    g_free (pending);
+}
+
+void
+request_finished_early (SoupMessage *msg, gpointer data)
+{
+    UZBL_UNUSED (msg);
+
+    UzblPendingRequest *pending = (UzblPendingRequest *)data;
+
+    /* WebKit gave up on the request (e.g., the page was left). */
+    pending->finished = TRUE;
+}
+
+void
+decide_request (GString *result, gpointer data)
+{
+    UzblPendingRequest *pending = (UzblPendingRequest *)data;
+
+    cache_decision (pending->key, result);
+
+    if (pending->finished) {
+        /* Nothing left to decide. */
+    } else if (!result->len) {
+        soup_session_unpause_message (pending->session, pending->message);
+    } else {
+        SoupURI *uri = soup_uri_new (result->str);
+
+        uzbl_debug ("Request rewritten -> %s\n", result->str);
+
+        if (uri && SOUP_URI_VALID_FOR_HTTP (uri)) {
+            soup_message_set_uri (pending->message, uri);
+            soup_session_unpause_message (pending->session, pending->message);
+        } else {
+            /* Anything else (such as about:blank) has nothing to fetch. */
+            soup_session_cancel_message (pending->session, pending->message, SOUP_STATUS_CANCELLED);
+        }
+
+        if (uri) {
+            soup_uri_free (uri);
+        }
+    }
+
+    free_pending_request (pending);
+}
+
+void
+drop_decision (GList *link)
+{
+    UzblCachedDecision *cached = (UzblCachedDecision *)link->data;
+
+    g_hash_table_remove (uzbl.gui_->decisions, cached->key);
+    g_queue_delete_link (&uzbl.gui_->decision_order, link);
+
+    g_free (cached->key);
+    g_free (cached->result);
+    g_free (cached);
+}
+
 void
 rewrite_request (GString *result, gpointer data)
 {
@@ -1748,10 +2223,10 @@ decide_destination_cb (WebKitDownload *download, const gchar *suggested_filename
 
     uzbl_debug ("Download requested -> %s\n", uri);
 
-    gchar *handler = uzbl_variables_get_string ("download_handler");
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_DOWNLOAD_HANDLER);
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *download_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *download_command = uzbl_commands_parse_cached (handler, args);
     g_free (handler);
     if (!download_command) {
         webkit_download_cancel (download);
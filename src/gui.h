@@ -5,6 +5,13 @@
 
 void
 uzbl_gui_update_title ();
+void
+uzbl_gui_update_variable (const gchar *name);
+
+void
+uzbl_gui_decision_cache_stats (GString *result);
+void
+uzbl_gui_decision_cache_clear ();
 
 void /* TODO: This should not be public. */
 handle_download (WebKitDownload *download, const gchar *suggested_destination);
@@ -1,5 +1,6 @@
 #include "io.h"
 
+#include "comm.h"
 #include "commands.h"
 #include "events.h"
 #include "setup.h"
@@ -23,15 +24,123 @@
 
 #include "3p/async-queue-source/rb-async-queue-watch.h"
 
+/* A stream which uzbl writes to. Writes are queued by the main thread and
+ * drained by the I/O thread so that a slow reader cannot stall the UI. */
+typedef struct {
+    gint         ref_count;
+    GIOStream   *stream;
+    /* The socket array which holds this socket, if any. */
+    GPtrArray   *owner;
+    const gchar *kind;
+
+    /* Everything below is shared with the I/O thread. */
+    GMutex       lock;
+    /* Queued messages (GBytes) and their total size. */
+    GQueue       queue;
+    gsize        queued_bytes;
+    /* When the oldest queued message was queued. */
+    gint64       queued_since;
+    /* Signalled when the queue is taken for writing or dropped. */
+    GCond        drained;
+    /* The batch currently being written, how many messages it holds and
+     * when the oldest of them was queued. */
+    GBytes      *current;
+    guint        current_events;
+    gint64       current_since;
+    gboolean     flushing;
+    gboolean     closed;
+    /* Replies to commands from this socket, in the order they arrived. */
+    GQueue       replies;
+
+    guint64      events_written;
+    guint64      events_dropped;
+    guint64      bytes_queued;
+    guint64      bytes_written;
+    /* The longest a message waited to be written and the total time senders
+     * waited for room in the queue (both in microseconds). */
+    gint64       max_latency;
+    gint64       blocked_time;
+
+    /* Only changed by the main thread, with the lock held. */
+    /* The events the other end subscribed to. */
+    UzblEventMask events;
+    /* How messages are delimited on the wire. */
+    UzblIOFraming framing;
+
+    /* Main thread only. */
+    /* Waiting for the pending batch to be flushed. */
+    gboolean     deferred;
+    /* Replies are held back while a pipeline of commands runs. */
+    guint        holding;
+} UzblIOSocket;
+
+/* A reply to a command read from a socket. Each holds a reference to the
+ * socket. */
+typedef struct {
+    UzblIOSocket *sock;
+    /* The client's ID for the command, if it gave one. */
+    gchar        *id;
+    /* NULL until the command finished. */
+    GString      *result;
+} UzblIOReply;
+
+/* A message sent from a thread other than the main one. */
+typedef struct _UzblIOOutgoing {
+    struct _UzblIOOutgoing *next;
+    UzblEventType           type;
+    gchar                  *message;
+    GBytes                 *frame;
+    UzblIOFlags             flags;
+} UzblIOOutgoing;
+
 struct _UzblIO {
     /* Sockets to connect to as event managers. */
     GPtrArray *connect_sockets;
     /* Sockets to connect to as clients. */
     GPtrArray *client_sockets;
-
-    /* The event buffer. */
-    GMutex     event_buffer_lock;
-    GPtrArray *event_buffer;
+    /* Held by the main thread while it changes the socket arrays and by the
+     * I/O thread while it walks them. Also guards the event masks below. */
+    GMutex     sockets_lock;
+
+    /* The events any text (or binary) framed socket subscribed to. */
+    UzblEventMask      event_mask;
+    UzblEventMask      frame_mask;
+    /* The socket the running command came from, if any. */
+    UzblIOSocket      *origin;
+    /* The running command and its result buffer. */
+    struct _UzblCommandData *running;
+    GString           *running_result;
+
+    /* The high-water mark for a socket's queue and what to do past it. */
+    gsize              queue_limit;
+    UzblIOOverflow     overflow;
+
+    /* Event batching. Sockets with deferred events are flushed together once
+     * the main loop is idle or the window (in microseconds) expires. */
+    gboolean           batching;
+    gint64             batch_window;
+    GPtrArray         *batch;
+    GSource           *batch_idle;
+    GSource           *batch_timeout;
+
+    /* The event buffer. Events sent before the event managers connect are
+     * kept in a ring of whole lines (oldest first) and replayed to them. */
+    GMutex             event_buffer_lock;
+    gchar             *event_buffer;
+    gsize              event_buffer_size;
+    gsize              event_buffer_head;
+    gsize              event_buffer_length;
+    guint64            event_buffer_dropped;
+    guint              event_buffer_lifetime;
+    guint              event_buffer_timeout;
+
+    /* Messages from other threads. A lock-free stack (newest first) which
+     * the I/O thread takes as a whole and delivers. */
+    UzblIOOutgoing    *outbox;
+    gint               outbox_scheduled;
+    GThread           *main_thread;
+    /* Mirrors the print_events variable for other threads. */
+    gint               print_events;
 
     /* Path to the main FIFO for client communication. */
     gchar *fifo_path;
@@ -54,21 +163,49 @@ flush_event_buffer (gpointer data);
 static void
 free_cmd_req (gpointer data);
 static void
-run_command (gpointer item, gpointer data);
+run_pipeline (gpointer item, gpointer data);
 static gpointer
 run_io (gpointer data);
+static void
+io_socket_unref (gpointer data);
 
 void
 uzbl_io_init ()
 {
     uzbl.io = g_malloc (sizeof (UzblIO));
 
-    uzbl.io->connect_sockets = g_ptr_array_new ();
-    uzbl.io->client_sockets = g_ptr_array_new ();
+    uzbl.io->connect_sockets = g_ptr_array_new_with_free_func (io_socket_unref);
+    uzbl.io->client_sockets = g_ptr_array_new_with_free_func (io_socket_unref);
+    g_mutex_init (&uzbl.io->sockets_lock);
+
+    uzbl_events_mask_clear (&uzbl.io->event_mask);
+    uzbl_events_mask_clear (&uzbl.io->frame_mask);
+    uzbl.io->origin = NULL;
+    uzbl.io->running = NULL;
+    uzbl.io->running_result = NULL;
+
+    uzbl.io->queue_limit = 1024 * 1024;
+    uzbl.io->overflow = UZBL_IO_OVERFLOW_COALESCE;
+
+    uzbl.io->batching = FALSE;
+    uzbl.io->batch_window = 5000;
+    uzbl.io->batch = g_ptr_array_new_with_free_func (io_socket_unref);
+    uzbl.io->batch_idle = NULL;
+    uzbl.io->batch_timeout = NULL;
 
     g_mutex_init (&uzbl.io->event_buffer_lock);
-    uzbl.io->event_buffer = g_ptr_array_new_with_free_func (g_free);
-    g_timeout_add_seconds (10, flush_event_buffer, NULL);
+    uzbl.io->event_buffer_size = 64 * 1024;
+    uzbl.io->event_buffer = g_malloc (uzbl.io->event_buffer_size);
+    uzbl.io->event_buffer_head = 0;
+    uzbl.io->event_buffer_length = 0;
+    uzbl.io->event_buffer_dropped = 0;
+    uzbl.io->event_buffer_lifetime = 10;
+    uzbl.io->event_buffer_timeout = g_timeout_add_seconds (uzbl.io->event_buffer_lifetime, flush_event_buffer, uzbl.io);
+
+    uzbl.io->outbox = NULL;
+    uzbl.io->outbox_scheduled = 0;
+    uzbl.io->main_thread = g_thread_self ();
+    uzbl.io->print_events = FALSE;
 
     uzbl.io->fifo_path = NULL;
     uzbl.io->socket_path = NULL;
@@ -76,24 +213,45 @@ uzbl_io_init ()
     uzbl.io->cmd_q = g_async_queue_new_full (free_cmd_req);
 
     uzbl_rb_async_queue_watch_new (uzbl.io->cmd_q,
-        G_PRIORITY_HIGH, run_command,
+        G_PRIORITY_HIGH, run_pipeline,
         NULL, NULL, NULL);
 
+    uzbl.io->io_ctx = g_main_context_new ();
+    uzbl.io->io_loop = g_main_loop_new (uzbl.io->io_ctx, FALSE);
     uzbl.io->io_thread = g_thread_new ("uzbl-io", run_io, NULL);
 }
 
+static void
+drain_socket (gpointer data, gpointer user_data);
+static void
+cancel_batch ();
+static gboolean
+drain_outbox (gpointer data);
+
 void
 uzbl_io_free ()
 {
+    cancel_batch ();
+    g_ptr_array_unref (uzbl.io->batch);
+
+    g_main_loop_quit (uzbl.io->io_loop);
+    g_thread_join (uzbl.io->io_thread);
+
+    /* Messages posted after the I/O thread stopped. */
+    drain_outbox (NULL);
+
+    g_main_loop_unref (uzbl.io->io_loop);
+    g_main_context_unref (uzbl.io->io_ctx);
+
+    /* Deliver anything still queued (e.g., INSTANCE_EXIT). */
+    g_ptr_array_foreach (uzbl.io->connect_sockets, drain_socket, NULL);
+    g_ptr_array_foreach (uzbl.io->client_sockets, drain_socket, NULL);
+
     g_ptr_array_unref (uzbl.io->connect_sockets);
     g_ptr_array_unref (uzbl.io->client_sockets);
+    g_mutex_clear (&uzbl.io->sockets_lock);
 
-    if (uzbl.io->event_buffer) {
-        g_mutex_lock (&uzbl.io->event_buffer_lock);
-        g_ptr_array_unref (uzbl.io->event_buffer);
-        uzbl.io->event_buffer = NULL;
-        g_mutex_unlock (&uzbl.io->event_buffer_lock);
-    }
+    flush_event_buffer (NULL);
     g_mutex_clear (&uzbl.io->event_buffer_lock);
 
     if (uzbl.io->fifo_path) {
@@ -107,7 +265,6 @@ uzbl_io_free ()
     g_free (uzbl.io->socket_path);
 
     g_async_queue_unref (uzbl.io->cmd_q);
-    g_thread_unref (uzbl.io->io_thread);
 
     g_free (uzbl.io);
     uzbl.io = NULL;
@@ -120,6 +277,8 @@ add_buffered_cmd_source (GIOStream *stream, const gchar *name, UzblIODataCallbac
                          UzblIODataErrorCallback error_callback, gpointer data);
 static gboolean
 control_command_stream (GIOStream *stream, const gchar *input, gpointer data);
+static UzblIOSocket *
+io_socket_new (GIOStream *stream, GPtrArray *owner, const gchar *kind);
 
 void
 uzbl_io_init_stdin ()
@@ -127,14 +286,24 @@ uzbl_io_init_stdin ()
     GInputStream *input = g_unix_input_stream_new (STDIN_FILENO, TRUE);
     GOutputStream *output = g_unix_output_stream_new (STDOUT_FILENO, TRUE);
     GIOStream *stream = g_simple_io_stream_new (input, output);
+    UzblIOSocket *sock = io_socket_new (stream, NULL, "stdin");
+
+    g_object_unref (input);
+    g_object_unref (output);
+
     add_buffered_cmd_source (stream, "Uzbl stdin watcher",
-                             control_command_stream, NULL, NULL);
+                             control_command_stream, NULL, sock);
+    g_object_unref (stream);
 }
 
 static void
 close_client_socket (GIOStream *stream, gpointer data);
+static UzblIOSocket *
+io_socket_ref (UzblIOSocket *sock);
 static void
-replay_event_buffer (GIOStream *stream);
+replay_event_buffer (UzblIOSocket *sock);
+static void
+update_event_mask ();
 
 gboolean
 uzbl_io_init_connect_socket (const gchar *socket_path)
@@ -154,12 +323,20 @@ uzbl_io_init_connect_socket (const gchar *socket_path)
         return FALSE;
     }
 
+    UzblIOSocket *sock = io_socket_new (G_IO_STREAM (con),
+                                        uzbl.io->connect_sockets, "connect");
+
     add_buffered_cmd_source (G_IO_STREAM (con), "Uzbl connect socket",
                              control_command_stream,
                              close_client_socket,
-                             uzbl.io->connect_sockets);
-    g_ptr_array_add (uzbl.io->connect_sockets, G_IO_STREAM (con));
-    replay_event_buffer (G_IO_STREAM (con));
+                             sock);
+    g_mutex_lock (&uzbl.io->sockets_lock);
+    g_ptr_array_add (uzbl.io->connect_sockets, io_socket_ref (sock));
+    g_mutex_unlock (&uzbl.io->sockets_lock);
+    update_event_mask ();
+    replay_event_buffer (sock);
+
+    g_object_unref (con);
 
     g_object_unref (client);
 
@@ -167,43 +344,115 @@ uzbl_io_init_connect_socket (const gchar *socket_path)
 }
 
 static void
-buffer_event (const gchar *message);
+send_message (UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags);
 static void
-send_event_sockets (GPtrArray *sockets, const gchar *message);
+buffer_event (const gchar *message);
+static gboolean
+send_event_sockets (GPtrArray *sockets, UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags);
 
 void
-uzbl_io_send (const gchar *message, gboolean connect_only)
+uzbl_io_send (const gchar *message, UzblIOFlags flags)
 {
-    if (!message) {
-        return;
+    /* Anything which is not an event goes to every socket. */
+    send_message (LAST_EVENT, message, NULL, flags);
+}
+
+void
+uzbl_io_send_event (UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags)
+{
+    send_message (type, message, frame, flags);
+}
+
+UzblIOFraming
+uzbl_io_event_wanted (UzblEventType type)
+{
+    UzblIOFraming wanted = 0;
+    gboolean framed;
+    gboolean text;
+
+    /* Any thread may ask while the masks are being rebuilt. */
+    g_mutex_lock (&uzbl.io->sockets_lock);
+    framed = uzbl_events_mask_has (&uzbl.io->frame_mask, type);
+    text = uzbl_events_mask_has (&uzbl.io->event_mask, type);
+    g_mutex_unlock (&uzbl.io->sockets_lock);
+
+    if (framed) {
+        wanted |= UZBL_IO_FRAMING_BINARY;
     }
 
-    if (!strchr (message, '\n')) {
-        return;
+    if (text) {
+        wanted |= UZBL_IO_FRAMING_TEXT;
+    } else if (uzbl.io->event_buffer) {
+        /* Buffered events are replayed to sockets which connect later. */
+        wanted |= UZBL_IO_FRAMING_TEXT;
+    } else if (g_atomic_int_get (&uzbl.io->print_events)) {
+        wanted |= UZBL_IO_FRAMING_TEXT;
     }
 
-    buffer_event (message);
+    return wanted;
+}
 
-    if (uzbl_variables_get_int ("print_events")) {
-        fprintf (stdout, "%s", message);
-        fflush (stdout);
+gboolean
+uzbl_io_subscribe (const UzblEventMask *mask)
+{
+    UzblIOSocket *sock = uzbl.io->origin;
+
+    if (!sock) {
+        return FALSE;
     }
 
-    /* Write to all --connect-socket sockets. */
-    send_event_sockets (uzbl.io->connect_sockets, message);
+    g_mutex_lock (&sock->lock);
+    if (mask) {
+        sock->events = *mask;
+    } else {
+        uzbl_events_mask_fill (&sock->events);
+    }
+    g_mutex_unlock (&sock->lock);
 
-    if (!connect_only) {
-        /* Write to all client sockets. */
-        send_event_sockets (uzbl.io->client_sockets, message);
+    update_event_mask ();
+
+    return TRUE;
+}
+
+static gboolean
+queue_message (UzblIOSocket *sock, const gchar *message, GBytes *frame, UzblIOFlags flags);
+
+gboolean
+uzbl_io_set_framing (UzblIOFraming framing)
+{
+    UzblIOSocket *sock = uzbl.io->origin;
+    gchar *marker;
+
+    if (!sock) {
+        return FALSE;
+    }
+
+    if (sock->framing == framing) {
+        return TRUE;
     }
+
+    /* Mark the switch in the old framing so the other end knows where the
+     * new one starts. */
+    marker = g_strdup_printf ("FRAMING %s\n",
+        (framing == UZBL_IO_FRAMING_BINARY) ? "binary" : "text");
+    queue_message (sock, marker, NULL, UZBL_IO_FORCE | UZBL_IO_URGENT);
+    g_free (marker);
+
+    g_mutex_lock (&sock->lock);
+    sock->framing = framing;
+    g_mutex_unlock (&sock->lock);
+    update_event_mask ();
+
+    return TRUE;
 }
 
-typedef struct {
+typedef struct _UzblCommandData {
     gchar *cmd;
     const UzblCommand *info;
     GArray *argv;
     UzblIOCallback callback;
     gpointer data;
+    UzblIOSocket *origin;
 } UzblCommandData;
 
 void
@@ -220,10 +469,48 @@ uzbl_io_schedule_command (const UzblCommand *cmd, GArray *argv, UzblIOCallback c
     cmd_data->argv = argv;
     cmd_data->callback = callback;
     cmd_data->data = data;
+    cmd_data->origin = NULL;
 
     g_async_queue_push (uzbl.io->cmd_q, cmd_data);
 }
 
+struct _UzblIOPending {
+    UzblIOCallback callback;
+    gpointer data;
+};
+
+UzblIOPending *
+uzbl_io_defer_result (GString *result)
+{
+    UzblCommandData *cmd = uzbl.io->running;
+    UzblIOPending *pending;
+
+    /* Only the result of a top-level command with somebody waiting for it
+     * may be delivered later. */
+    if (!cmd || !cmd->callback || !result || (result != uzbl.io->running_result)) {
+        return NULL;
+    }
+
+    pending = g_malloc (sizeof (UzblIOPending));
+    pending->callback = cmd->callback;
+    pending->data = cmd->data;
+
+    cmd->callback = NULL;
+
+    return pending;
+}
+
+void
+uzbl_io_complete_result (UzblIOPending *pending, const gchar *result)
+{
+    GString *str = g_string_new (result ? result : "");
+
+    pending->callback (str, pending->data);
+
+    g_string_free (str, TRUE);
+    g_free (pending);
+}
+
 typedef enum {
     UZBL_COMM_FIFO,
     UZBL_COMM_SOCKET
@@ -332,26 +619,147 @@ uzbl_io_quit ()
     g_main_loop_quit (uzbl.io->io_loop);
 }
 
-/* ===================== HELPER IMPLEMENTATIONS ===================== */
+static void
+resize_event_buffer (gsize size);
+
+void
+uzbl_io_set_buffer_size (gsize size)
+{
+    if (!size) {
+        flush_event_buffer (NULL);
+        return;
+    }
+
+    g_mutex_lock (&uzbl.io->event_buffer_lock);
+    if (uzbl.io->event_buffer) {
+        resize_event_buffer (size);
+    }
+    g_mutex_unlock (&uzbl.io->event_buffer_lock);
+}
+
+void
+uzbl_io_set_buffer_lifetime (guint lifetime)
+{
+    if (!uzbl.io->event_buffer) {
+        return;
+    }
+
+    uzbl.io->event_buffer_lifetime = lifetime;
+
+    if (uzbl.io->event_buffer_timeout) {
+        g_source_remove (uzbl.io->event_buffer_timeout);
+    }
+    uzbl.io->event_buffer_timeout = g_timeout_add_seconds (lifetime, flush_event_buffer, uzbl.io);
+}
+
+guint64
+uzbl_io_get_buffer_dropped ()
+{
+    return uzbl.io->event_buffer_dropped;
+}
+
+void
+uzbl_io_set_print_events (gboolean print_events)
+{
+    g_atomic_int_set (&uzbl.io->print_events, print_events);
+}
+
+gboolean
+uzbl_io_get_print_events ()
+{
+    return g_atomic_int_get (&uzbl.io->print_events);
+}
+
+void
+uzbl_io_set_queue_limit (gsize limit)
+{
+    uzbl.io->queue_limit = limit;
+}
+
+gsize
+uzbl_io_get_queue_limit ()
+{
+    return uzbl.io->queue_limit;
+}
+
+void
+uzbl_io_set_overflow (UzblIOOverflow overflow)
+{
+    uzbl.io->overflow = overflow;
+}
+
+UzblIOOverflow
+uzbl_io_get_overflow ()
+{
+    return uzbl.io->overflow;
+}
+
+void
+uzbl_io_set_batching (gboolean batching)
+{
+    uzbl.io->batching = batching;
+}
+
+gboolean
+uzbl_io_get_batching ()
+{
+    return uzbl.io->batching;
+}
+
+void
+uzbl_io_set_batch_window (gint64 window)
+{
+    uzbl.io->batch_window = window;
+}
+
+gint64
+uzbl_io_get_batch_window ()
+{
+    return uzbl.io->batch_window;
+}
 
 static void
-send_buffered_event (gpointer event, gpointer data);
+append_socket_stats (GString *result, GPtrArray *sockets, gboolean *first);
+
+void
+uzbl_io_dump_stats (GString *result)
+{
+    gboolean first = TRUE;
+
+    g_string_append_c (result, '[');
+    append_socket_stats (result, uzbl.io->connect_sockets, &first);
+    append_socket_stats (result, uzbl.io->client_sockets, &first);
+    g_string_append_c (result, ']');
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
 
 gboolean
 flush_event_buffer (gpointer data)
 {
-    UZBL_UNUSED (data);
+    /* The timeout passes the I/O state; anyone else must cancel it. */
+    if (!data && uzbl.io->event_buffer_timeout) {
+        g_source_remove (uzbl.io->event_buffer_timeout);
+    }
+    uzbl.io->event_buffer_timeout = 0;
 
     if (!uzbl.io->event_buffer) {
         return FALSE;
     }
 
+    /* Everything in the buffer has already been sent to the connected
+     * sockets; it only needs to be released. */
     g_mutex_lock (&uzbl.io->event_buffer_lock);
-    g_ptr_array_foreach (uzbl.io->event_buffer, send_buffered_event, NULL);
-    g_ptr_array_free (uzbl.io->event_buffer, TRUE);
+    g_free (uzbl.io->event_buffer);
     uzbl.io->event_buffer = NULL;
+    uzbl.io->event_buffer_length = 0;
     g_mutex_unlock (&uzbl.io->event_buffer_lock);
 
+    if (uzbl.io->event_buffer_dropped) {
+        uzbl_debug ("Event buffer overflowed: %" G_GUINT64_FORMAT " events were not replayed\n",
+                    uzbl.io->event_buffer_dropped);
+    }
+
     return FALSE;
 }
 
@@ -365,27 +773,81 @@ free_cmd_req (gpointer data)
     g_free (cmd);
 }
 
+static void
+run_command (UzblCommandData *cmd);
+static void
+release_replies (UzblIOSocket *sock);
+
+/* The most commands run in a single dispatch. */
+#define UZBL_IO_PIPELINE_MAX 64
+
 void
-run_command (gpointer item, gpointer data)
+run_pipeline (gpointer item, gpointer data)
 {
     UZBL_UNUSED (data);
 
     UzblCommandData *cmd = (UzblCommandData *)item;
+    GHashTable *held = g_hash_table_new (g_direct_hash, g_direct_equal);
+    GHashTableIter iter;
+    gpointer key;
+    guint count = 0;
+
+    /* Run whatever has queued up back to back. Replies to each socket are
+     * held until the end so that they go out in a single write. */
+    do {
+        UzblIOSocket *origin = cmd->origin;
+
+        if (origin && !g_hash_table_contains (held, origin)) {
+            ++origin->holding;
+            g_hash_table_add (held, io_socket_ref (origin));
+        }
+
+        run_command (cmd);
+    } while ((++count < UZBL_IO_PIPELINE_MAX) &&
+             (cmd = g_async_queue_try_pop (uzbl.io->cmd_q)));
+
+    g_hash_table_iter_init (&iter, held);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        UzblIOSocket *sock = (UzblIOSocket *)key;
+
+        if (!--sock->holding) {
+            release_replies (sock);
+        }
+        io_socket_unref (sock);
+    }
 
+    g_hash_table_unref (held);
+}
+
+void
+run_command (UzblCommandData *cmd)
+{
     GString *result = NULL;
 
     if (cmd->callback) {
         result = g_string_new ("");
     }
 
+    uzbl.io->origin = cmd->origin;
+    uzbl.io->running = cmd;
+    uzbl.io->running_result = result;
+
     if (cmd->cmd) {
         uzbl_commands_run (cmd->cmd, result);
     } else {
         uzbl_commands_run_parsed (cmd->info, cmd->argv, result);
     }
 
+    uzbl.io->origin = NULL;
+    uzbl.io->running = NULL;
+    uzbl.io->running_result = NULL;
+
+    /* Unless the command deferred its result. */
     if (cmd->callback) {
         cmd->callback (result, cmd->data);
+    }
+
+    if (result) {
         g_string_free (result, TRUE);
     }
 
@@ -397,28 +859,123 @@ run_io (gpointer data)
 {
     UZBL_UNUSED (data);
 
-    uzbl.io->io_ctx = g_main_context_new ();
-
-    uzbl.io->io_loop = g_main_loop_new (uzbl.io->io_ctx, FALSE);
+    /* Asynchronous operations started from this thread complete here. */
+    g_main_context_push_thread_default (uzbl.io->io_ctx);
     g_main_loop_run (uzbl.io->io_loop);
-    g_main_loop_unref (uzbl.io->io_loop);
-    uzbl.io->io_loop = NULL;
-
-    g_main_context_unref (uzbl.io->io_ctx);
-    uzbl.io->io_ctx = NULL;
+    g_main_context_pop_thread_default (uzbl.io->io_ctx);
 
     return NULL;
 }
 
+static void
+clear_socket_queue (UzblIOSocket *sock);
+
+void
+io_socket_unref (gpointer data)
+{
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+
+    if (!g_atomic_int_dec_and_test (&sock->ref_count)) {
+        return;
+    }
+
+    clear_socket_queue (sock);
+    if (sock->current) {
+        g_bytes_unref (sock->current);
+    }
+    g_cond_clear (&sock->drained);
+    g_mutex_clear (&sock->lock);
+    g_object_unref (sock->stream);
+    g_free (sock);
+}
+
+void
+drain_socket (gpointer data, gpointer user_data)
+{
+    UZBL_UNUSED (user_data);
+
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+    GOutputStream *output = g_io_stream_get_output_stream (sock->stream);
+    GError *error = NULL;
+    GBytes *bytes;
+
+    /* A write which never finished leaves the stream busy. */
+    if (sock->closed || sock->current) {
+        return;
+    }
+
+    while ((bytes = g_queue_pop_head (&sock->queue))) {
+        gsize size;
+        gconstpointer buf = g_bytes_get_data (bytes, &size);
+
+        if (!g_output_stream_write_all (output, buf, size, NULL, NULL, &error)) {
+            g_warning ("Error writing: %s", error->message);
+            g_clear_error (&error);
+            g_bytes_unref (bytes);
+            break;
+        }
+
+        g_bytes_unref (bytes);
+    }
+
+    clear_socket_queue (sock);
+}
+
+UzblIOSocket *
+io_socket_new (GIOStream *stream, GPtrArray *owner, const gchar *kind)
+{
+    UzblIOSocket *sock = g_malloc0 (sizeof (UzblIOSocket));
+
+    sock->ref_count = 1;
+    sock->stream = g_object_ref (stream);
+    sock->owner = owner;
+    sock->kind = kind;
+
+    g_mutex_init (&sock->lock);
+    g_cond_init (&sock->drained);
+    g_queue_init (&sock->queue);
+    g_queue_init (&sock->replies);
+
+    uzbl_events_mask_fill (&sock->events);
+    sock->framing = UZBL_IO_FRAMING_TEXT;
+
+    return sock;
+}
+
+static void
+append_socket_stats_one (gpointer data, gpointer user_data);
+
+void
+append_socket_stats (GString *result, GPtrArray *sockets, gboolean *first)
+{
+    guint i;
+
+    for (i = 0; i < sockets->len; ++i) {
+        if (!*first) {
+            g_string_append_c (result, ',');
+        }
+        *first = FALSE;
+
+        append_socket_stats_one (g_ptr_array_index (sockets, i), result);
+    }
+}
+
 typedef struct {
     UzblIODataCallback callback;
     UzblIODataErrorCallback error_callback;
     GIOStream *stream;
+    GDataInputStream *input;
     gpointer data;
 } UzblIOBufferData;
 
+static gboolean
+start_reading (gpointer data);
 static void
 read_line_cb (GObject *source, GAsyncResult *res, gpointer data);
+static gboolean
+report_read_error (gpointer data);
+static gboolean
+line_buffered (GDataInputStream *ds);
 
 void
 add_buffered_cmd_source (GIOStream *stream, const gchar *name,
@@ -435,13 +992,29 @@ add_buffered_cmd_source (GIOStream *stream, const gchar *name,
     io_data->callback = callback;
     io_data->error_callback = error_callback;
     io_data->stream = stream;
+    io_data->input = ds;
     io_data->data = data;
 
-    g_data_input_stream_read_line_async (ds, G_PRIORITY_DEFAULT, NULL,
+    /* Read on the I/O thread so that replies to requests arrive while the
+     * main thread waits for them. */
+    GSource *source = g_idle_source_new ();
+    g_source_set_callback (source, start_reading, io_data, NULL);
+    g_source_attach (source, uzbl.io->io_ctx);
+    g_source_unref (source);
+}
+
+gboolean
+start_reading (gpointer data)
+{
+    UzblIOBufferData *io_data = (UzblIOBufferData *)data;
+
+    g_data_input_stream_read_line_async (io_data->input, G_PRIORITY_DEFAULT, NULL,
                                          read_line_cb, (gpointer) io_data);
+
+    return FALSE;
 }
 
-static void
+void
 read_line_cb (GObject *source, GAsyncResult *res, gpointer data)
 {
     UzblIOBufferData *io_data = (UzblIOBufferData *)data;
@@ -455,75 +1028,155 @@ read_line_cb (GObject *source, GAsyncResult *res, gpointer data)
         g_clear_error (&error);
 
         if (io_data->error_callback) {
-            io_data->error_callback (io_data->stream, io_data->data);
+            g_idle_add (report_read_error, io_data);
             return;
         }
     }
 
     if (!line) {
         if (io_data->error_callback) {
-            io_data->error_callback (io_data->stream, io_data->data);
+            g_idle_add (report_read_error, io_data);
             return;
         }
     }
 
-    io_data->callback (io_data->stream, line, data);
-    g_free (line);
+    /* Hand over every complete line which has already arrived at once so
+     * that the main thread can run them as a single pipeline. */
+    g_async_queue_lock (uzbl.io->cmd_q);
+
+    do {
+        io_data->callback (io_data->stream, line, io_data->data);
+        g_free (line);
+    } while (line_buffered (ds) &&
+             (line = g_data_input_stream_read_line (ds, &length, NULL, NULL)));
+
+    g_async_queue_unlock (uzbl.io->cmd_q);
 
     g_data_input_stream_read_line_async (ds, G_PRIORITY_DEFAULT, NULL,
                                          read_line_cb, data);
 }
 
-static void
-schedule_io_input (gchar *line, UzblIOCallback callback, gpointer data);
-
-static void
-write_result_to_stream (GString *result, gpointer data);
-
+gboolean
+line_buffered (GDataInputStream *ds)
+{
+    gsize available;
+    const gchar *buf = g_buffered_input_stream_peek_buffer (G_BUFFERED_INPUT_STREAM (ds), &available);
+
+    return (memchr (buf, '\n', available) != NULL);
+}
+
+gboolean
+report_read_error (gpointer data)
+{
+    UzblIOBufferData *io_data = (UzblIOBufferData *)data;
+
+    /* Error callbacks touch main thread state. */
+    io_data->error_callback (io_data->stream, io_data->data);
+
+    g_object_unref (io_data->input);
+    g_free (io_data);
+
+    return FALSE;
+}
+
+static gboolean
+schedule_io_input (gchar *line, UzblIOSocket *origin);
+
+static void
+write_result_to_stream (GString *result, gpointer data);
+
 gboolean
 control_command_stream (GIOStream *stream, const gchar *input, gpointer data)
 {
-    UZBL_UNUSED (data);
+    UZBL_UNUSED (stream);
+
+    UzblIOSocket *sock = (UzblIOSocket *)data;
 
-    g_object_ref (G_OBJECT (stream));
     gchar *ctl_line = g_strdup (input);
-    schedule_io_input (ctl_line, write_result_to_stream, stream);
+    if (!schedule_io_input (ctl_line, io_socket_ref (sock))) {
+        io_socket_unref (sock);
+    }
 
     return TRUE;
 }
 
+static void
+close_socket (UzblIOSocket *sock);
+static gboolean
+detach_socket (gpointer data);
+
 void
 close_client_socket (GIOStream *stream, gpointer data)
 {
-    GError *error = NULL;
-    gboolean ok = g_io_stream_close (stream, NULL, &error);
-    GPtrArray *socket_array = (GPtrArray *)data;
+    UZBL_UNUSED (stream);
+
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+
+    close_socket (sock);
+    detach_socket (sock);
 
-    if (socket_array) {
-        g_ptr_array_remove_fast (socket_array, stream);
+    /* Drop the reference held by the reader. */
+    io_socket_unref (sock);
+}
+
+gboolean
+detach_socket (gpointer data)
+{
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+    gboolean removed = FALSE;
+
+    if (sock->owner) {
+        g_mutex_lock (&uzbl.io->sockets_lock);
+        removed = g_ptr_array_remove_fast (sock->owner, sock);
+        g_mutex_unlock (&uzbl.io->sockets_lock);
     }
 
-    if (!ok) {
-        g_warning ("Error shutting down client socket: %s", error->message);
-        g_clear_error (&error);
+    if (removed) {
+        update_event_mask ();
     }
+
+    return FALSE;
+}
+
+UzblIOSocket *
+io_socket_ref (UzblIOSocket *sock)
+{
+    g_atomic_int_inc (&sock->ref_count);
+
+    return sock;
 }
 
 static void
-send_buffered_event_to_socket (gpointer event, gpointer data);
+copy_event_buffer (gchar *dest);
+static gboolean
+queue_bytes (UzblIOSocket *sock, GBytes *bytes, UzblIOFlags flags);
 
 void
-replay_event_buffer (GIOStream *stream)
+replay_event_buffer (UzblIOSocket *sock)
 {
-    if (!uzbl.io->event_buffer) {
-        return;
-    }
+    GBytes *bytes = NULL;
 
     g_mutex_lock (&uzbl.io->event_buffer_lock);
-    g_ptr_array_foreach (uzbl.io->event_buffer, send_buffered_event_to_socket, stream);
+    if (uzbl.io->event_buffer && uzbl.io->event_buffer_length) {
+        gchar *data = g_malloc (uzbl.io->event_buffer_length);
+
+        copy_event_buffer (data);
+        bytes = g_bytes_new_take (data, uzbl.io->event_buffer_length);
+    }
     g_mutex_unlock (&uzbl.io->event_buffer_lock);
+
+    if (!bytes) {
+        return;
+    }
+
+    /* The whole buffer goes out as a single write. */
+    queue_bytes (sock, bytes, UZBL_IO_FORCE);
+    g_bytes_unref (bytes);
 }
 
+static void
+drop_buffered_event ();
+
 void
 buffer_event (const gchar *message)
 {
@@ -531,18 +1184,323 @@ buffer_event (const gchar *message)
         return;
     }
 
+    gsize size = strlen (message);
+
     g_mutex_lock (&uzbl.io->event_buffer_lock);
-    g_ptr_array_add (uzbl.io->event_buffer, g_strdup (message));
+
+    if (!uzbl.io->event_buffer) {
+        g_mutex_unlock (&uzbl.io->event_buffer_lock);
+        return;
+    }
+
+    if (uzbl.io->event_buffer_size < size) {
+        ++uzbl.io->event_buffer_dropped;
+        g_mutex_unlock (&uzbl.io->event_buffer_lock);
+        return;
+    }
+
+    /* Make room by dropping the oldest events. */
+    while (uzbl.io->event_buffer_size - uzbl.io->event_buffer_length < size) {
+        drop_buffered_event ();
+    }
+
+    gsize tail = (uzbl.io->event_buffer_head + uzbl.io->event_buffer_length) % uzbl.io->event_buffer_size;
+    gsize first = MIN (size, uzbl.io->event_buffer_size - tail);
+
+    memcpy (uzbl.io->event_buffer + tail, message, first);
+    memcpy (uzbl.io->event_buffer, message + first, size - first);
+    uzbl.io->event_buffer_length += size;
+
     g_mutex_unlock (&uzbl.io->event_buffer_lock);
 }
 
+void
+copy_event_buffer (gchar *dest)
+{
+    gsize head = uzbl.io->event_buffer_head;
+    gsize length = uzbl.io->event_buffer_length;
+    gsize first = MIN (length, uzbl.io->event_buffer_size - head);
+
+    memcpy (dest, uzbl.io->event_buffer + head, first);
+    memcpy (dest + first, uzbl.io->event_buffer, length - first);
+}
+
+void
+drop_buffered_event ()
+{
+    gsize head = uzbl.io->event_buffer_head;
+    gsize length = uzbl.io->event_buffer_length;
+    gsize first = MIN (length, uzbl.io->event_buffer_size - head);
+    const gchar *end = memchr (uzbl.io->event_buffer + head, '\n', first);
+    gsize size = length;
+
+    if (end) {
+        size = end - (uzbl.io->event_buffer + head) + 1;
+    } else if ((end = memchr (uzbl.io->event_buffer, '\n', length - first))) {
+        size = first + (end - uzbl.io->event_buffer) + 1;
+    }
+
+    uzbl.io->event_buffer_head = (head + size) % uzbl.io->event_buffer_size;
+    uzbl.io->event_buffer_length -= size;
+    ++uzbl.io->event_buffer_dropped;
+}
+
+void
+resize_event_buffer (gsize size)
+{
+    gchar *buffer;
+
+    while (size < uzbl.io->event_buffer_length) {
+        drop_buffered_event ();
+    }
+
+    buffer = g_malloc (size);
+    copy_event_buffer (buffer);
+
+    g_free (uzbl.io->event_buffer);
+    uzbl.io->event_buffer = buffer;
+    uzbl.io->event_buffer_size = size;
+    uzbl.io->event_buffer_head = 0;
+}
+
+static void
+post_message (UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags);
 static void
-write_to_stream (GIOStream *stream, const gchar *message);
+print_event (const gchar *message);
 
 void
-send_event_sockets (GPtrArray *sockets, const gchar *message)
+send_message (UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags)
 {
-    g_ptr_array_foreach (sockets, (GFunc)write_to_stream, (gpointer)message);
+    gboolean removed = FALSE;
+
+    if (!message && !frame) {
+        return;
+    }
+
+    if (message && !strchr (message, '\n')) {
+        return;
+    }
+
+    if (g_thread_self () != uzbl.io->main_thread) {
+        post_message (type, message, frame, flags);
+        return;
+    }
+
+    if (message) {
+        buffer_event (message);
+        print_event (message);
+    }
+
+    /* Write to all --connect-socket sockets. */
+    removed |= send_event_sockets (uzbl.io->connect_sockets, type, message, frame, flags);
+
+    if (!(flags & UZBL_IO_CONNECT_ONLY)) {
+        /* Write to all client sockets. */
+        removed |= send_event_sockets (uzbl.io->client_sockets, type, message, frame, flags);
+    }
+
+    if (removed) {
+        update_event_mask ();
+    }
+}
+
+gboolean
+send_event_sockets (GPtrArray *sockets, UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags)
+{
+    gboolean removed = FALSE;
+    guint i = sockets->len;
+
+    /* Iterate backwards so that disconnected sockets may be removed. */
+    while (i--) {
+        UzblIOSocket *sock = g_ptr_array_index (sockets, i);
+
+        if ((type != LAST_EVENT) && !uzbl_events_mask_has (&sock->events, type)) {
+            continue;
+        }
+
+        if (!queue_message (sock, message, frame, flags)) {
+            g_warning ("Disconnecting %s socket: too many pending events", sock->kind);
+            close_socket (sock);
+            g_mutex_lock (&uzbl.io->sockets_lock);
+            g_ptr_array_remove_index_fast (sockets, i);
+            g_mutex_unlock (&uzbl.io->sockets_lock);
+            removed = TRUE;
+        }
+    }
+
+    return removed;
+}
+
+void
+print_event (const gchar *message)
+{
+    if (g_atomic_int_get (&uzbl.io->print_events)) {
+        fprintf (stdout, "%s", message);
+        fflush (stdout);
+    }
+}
+
+void
+post_message (UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags)
+{
+    UzblIOOutgoing *msg = g_malloc (sizeof (UzblIOOutgoing));
+    UzblIOOutgoing *head;
+
+    msg->type = type;
+    msg->message = g_strdup (message);
+    msg->frame = frame ? g_bytes_ref (frame) : NULL;
+    msg->flags = flags;
+
+    do {
+        head = g_atomic_pointer_get (&uzbl.io->outbox);
+        msg->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange (&uzbl.io->outbox, head, msg));
+
+    /* One drain per burst; it picks up everything posted before it runs. */
+    if (g_atomic_int_compare_and_exchange (&uzbl.io->outbox_scheduled, 0, 1)) {
+        GSource *source = g_idle_source_new ();
+
+        g_source_set_callback (source, drain_outbox, NULL, NULL);
+        g_source_attach (source, uzbl.io->io_ctx);
+        g_source_unref (source);
+    }
+}
+
+static void
+deliver_message (UzblIOOutgoing *msg);
+
+/* Runs in the I/O thread (or after it has stopped). */
+gboolean
+drain_outbox (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    UzblIOOutgoing *list;
+    UzblIOOutgoing *ordered = NULL;
+
+    /* Clear the flag first so that a message posted from here on schedules
+     * another drain. */
+    g_atomic_int_set (&uzbl.io->outbox_scheduled, 0);
+
+    do {
+        list = g_atomic_pointer_get (&uzbl.io->outbox);
+    } while (!g_atomic_pointer_compare_and_exchange (&uzbl.io->outbox, list, NULL));
+
+    /* The stack is newest first. */
+    while (list) {
+        UzblIOOutgoing *next = list->next;
+
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    while (ordered) {
+        UzblIOOutgoing *next = ordered->next;
+
+        deliver_message (ordered);
+
+        g_free (ordered->message);
+        if (ordered->frame) {
+            g_bytes_unref (ordered->frame);
+        }
+        g_free (ordered);
+
+        ordered = next;
+    }
+
+    return FALSE;
+}
+
+static void
+deliver_message_sockets (GPtrArray *sockets, UzblIOOutgoing *msg);
+
+void
+deliver_message (UzblIOOutgoing *msg)
+{
+    if (msg->message) {
+        buffer_event (msg->message);
+        print_event (msg->message);
+    }
+
+    g_mutex_lock (&uzbl.io->sockets_lock);
+
+    deliver_message_sockets (uzbl.io->connect_sockets, msg);
+
+    if (!(msg->flags & UZBL_IO_CONNECT_ONLY)) {
+        deliver_message_sockets (uzbl.io->client_sockets, msg);
+    }
+
+    g_mutex_unlock (&uzbl.io->sockets_lock);
+}
+
+void
+deliver_message_sockets (GPtrArray *sockets, UzblIOOutgoing *msg)
+{
+    guint i;
+
+    for (i = 0; i < sockets->len; ++i) {
+        UzblIOSocket *sock = g_ptr_array_index (sockets, i);
+        gboolean wanted;
+
+        g_mutex_lock (&sock->lock);
+        wanted = (msg->type == LAST_EVENT) || uzbl_events_mask_has (&sock->events, msg->type);
+        g_mutex_unlock (&sock->lock);
+
+        if (!wanted) {
+            continue;
+        }
+
+        /* The drain is a batch of its own; batching only applies to the main
+         * thread. */
+        if (!queue_message (sock, msg->message, msg->frame, msg->flags | UZBL_IO_URGENT)) {
+            g_warning ("Disconnecting %s socket: too many pending events", sock->kind);
+            close_socket (sock);
+            /* The socket arrays belong to the main thread. */
+            g_idle_add_full (G_PRIORITY_DEFAULT, detach_socket,
+                             io_socket_ref (sock), io_socket_unref);
+        }
+    }
+}
+
+static void
+merge_socket_mask (gpointer data, gpointer user_data);
+
+void
+update_event_mask ()
+{
+    /* The text framed mask, then the binary framed one. */
+    UzblEventMask masks[2];
+
+    uzbl_events_mask_clear (&masks[0]);
+    uzbl_events_mask_clear (&masks[1]);
+
+    /* Only the main thread changes the arrays, so they can be walked freely
+     * here; readers must never see a partially rebuilt mask though. */
+    g_ptr_array_foreach (uzbl.io->connect_sockets, merge_socket_mask, masks);
+    g_ptr_array_foreach (uzbl.io->client_sockets, merge_socket_mask, masks);
+
+    g_mutex_lock (&uzbl.io->sockets_lock);
+    uzbl.io->event_mask = masks[0];
+    uzbl.io->frame_mask = masks[1];
+    g_mutex_unlock (&uzbl.io->sockets_lock);
+}
+
+void
+merge_socket_mask (gpointer data, gpointer user_data)
+{
+    UzblEventMask *masks = (UzblEventMask *)user_data;
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+
+    g_mutex_lock (&sock->lock);
+
+    if (sock->framing == UZBL_IO_FRAMING_BINARY) {
+        uzbl_events_mask_merge (&masks[1], &sock->events);
+    } else {
+        uzbl_events_mask_merge (&masks[0], &sock->events);
+    }
+
+    g_mutex_unlock (&sock->lock);
 }
 
 gchar *
@@ -631,8 +1589,10 @@ attach_fifo (const gchar *path)
         return FALSE;
     }
 
+    UzblIOSocket *sock = io_socket_new (G_IO_STREAM (stream), NULL, "fifo");
     add_buffered_cmd_source (G_IO_STREAM (stream), "Uzbl main fifo",
-                             control_command_stream, NULL, NULL);
+                             control_command_stream, NULL, sock);
+    g_object_unref (stream);
     uzbl.io->fifo_path = g_strdup (path);
     uzbl_events_send (FIFO_SET, NULL,
                       TYPE_STR, uzbl.io->fifo_path,
@@ -700,21 +1660,11 @@ attach_socket (const gchar *path)
     return TRUE;
 }
 
-void
-send_buffered_event (gpointer event, gpointer data)
-{
-    UZBL_UNUSED (data);
-
-    const gchar *message = (const gchar *)event;
-
-    send_event_sockets (uzbl.io->connect_sockets, message);
-}
-
-void
-schedule_io_input (gchar *line, UzblIOCallback callback, gpointer data)
+gboolean
+schedule_io_input (gchar *line, UzblIOSocket *origin)
 {
     if (!line) {
-        return;
+        return FALSE;
     }
 
     remove_trailing_newline (line);
@@ -723,61 +1673,646 @@ schedule_io_input (gchar *line, UzblIOCallback callback, gpointer data)
         uzbl_requests_set_reply (line);
 
         g_free (line);
+        return FALSE;
     } else {
         UzblCommandData *cmd_data = g_malloc (sizeof (UzblCommandData));
         cmd_data->cmd = line;
         cmd_data->info = NULL;
         cmd_data->argv = NULL;
-        cmd_data->callback = callback;
-        cmd_data->data = data;
+        UzblIOReply *reply = g_malloc (sizeof (UzblIOReply));
+        reply->sock = origin;
+        reply->id = NULL;
+        reply->result = NULL;
+
+        /* Commands may be tagged as "REQUEST-<ID> <COMMAND>"; the reply is
+         * then "REPLY-<ID> <RESULT>". */
+        if (g_str_has_prefix (line, "REQUEST-")) {
+            const gchar *id = line + strlen ("REQUEST-");
+            const gchar *end = strchr (id, ' ');
+
+            if (!end) {
+                end = id + strlen (id);
+            }
+
+            reply->id = g_strndup (id, end - id);
+            cmd_data->cmd = g_strdup (*end ? end + 1 : "");
+            g_free (line);
+        }
 
-        g_async_queue_push (uzbl.io->cmd_q, cmd_data);
+        /* Reserve the reply's place in line. */
+        g_mutex_lock (&origin->lock);
+        g_queue_push_tail (&origin->replies, reply);
+        g_mutex_unlock (&origin->lock);
+
+        cmd_data->callback = write_result_to_stream;
+        cmd_data->data = reply;
+        cmd_data->origin = origin;
+
+        /* The reader holds the queue's lock. */
+        g_async_queue_push_unlocked (uzbl.io->cmd_q, cmd_data);
     }
+
+    return TRUE;
 }
 
 void
 write_result_to_stream (GString *result, gpointer data)
 {
-    GIOStream *stream = G_IO_STREAM (data);
+    UzblIOReply *reply = (UzblIOReply *)data;
+    UzblIOSocket *sock = reply->sock;
+
+    reply->result = g_string_new ("");
+    if (reply->id) {
+        g_string_append_printf (reply->result, "REPLY-%s ", reply->id);
+    }
+    g_string_append_len (reply->result, result->str, result->len);
+    g_string_append_c (reply->result, '\n');
+
+    if (!sock->holding) {
+        release_replies (sock);
+    }
+}
+
+void
+release_replies (UzblIOSocket *sock)
+{
+    GQueue ready = G_QUEUE_INIT;
+    GByteArray *out;
+    GBytes *bytes;
+    UzblIOReply *reply;
+    UzblIOFraming framing;
+    guint count = 0;
+
+    /* Replies go out in the order the commands arrived; a deferred result
+     * holds back the ones after it. */
+    g_mutex_lock (&sock->lock);
+    while ((reply = g_queue_peek_head (&sock->replies)) && reply->result) {
+        g_queue_push_tail (&ready, g_queue_pop_head (&sock->replies));
+    }
+    framing = sock->framing;
+    g_mutex_unlock (&sock->lock);
+
+    if (g_queue_is_empty (&ready)) {
+        return;
+    }
+
+    out = g_byte_array_new ();
+
+    while ((reply = g_queue_pop_head (&ready))) {
+        if (framing == UZBL_IO_FRAMING_BINARY) {
+            gsize size;
+            GBytes *frame = uzbl_comm_frame_text (reply->result->str);
+            gconstpointer buf = g_bytes_get_data (frame, &size);
+
+            g_byte_array_append (out, buf, size);
+            g_bytes_unref (frame);
+        } else {
+            g_byte_array_append (out, (const guint8 *)reply->result->str, reply->result->len);
+        }
+
+        g_string_free (reply->result, TRUE);
+        g_free (reply->id);
+        g_free (reply);
+        ++count;
+    }
+
+    /* Replies are never dropped or delayed. */
+    bytes = g_byte_array_free_to_bytes (out);
+    queue_bytes (sock, bytes, UZBL_IO_FORCE | UZBL_IO_URGENT);
+    g_bytes_unref (bytes);
+
+    /* Each reply held a reference. */
+    while (count--) {
+        io_socket_unref (sock);
+    }
+}
+
+static gboolean
+coalesce_message (UzblIOSocket *sock, GBytes *message);
+static void
+schedule_io (GSourceFunc func, UzblIOSocket *sock);
+static void
+defer_socket (UzblIOSocket *sock);
+static gboolean
+flush_socket (gpointer data);
+static void
+write_to_socket (UzblIOSocket *sock);
+static void
+wait_for_room (UzblIOSocket *sock, gsize size);
+
+gboolean
+queue_message (UzblIOSocket *sock, const gchar *message, GBytes *frame, UzblIOFlags flags)
+{
+    GOutputStream *output = g_io_stream_get_output_stream (sock->stream);
+    GBytes *bytes;
+    UzblIOFraming framing;
+    gboolean ret = TRUE;
+
+    if (!output || g_output_stream_is_closed (output)) {
+        return TRUE;
+    }
+
+    g_mutex_lock (&sock->lock);
+    framing = sock->framing;
+    g_mutex_unlock (&sock->lock);
+
+    if (framing == UZBL_IO_FRAMING_BINARY) {
+        if (frame) {
+            bytes = g_bytes_ref (frame);
+        } else if (message) {
+            bytes = uzbl_comm_frame_text (message);
+        } else {
+            return TRUE;
+        }
+    } else if (message) {
+        bytes = g_bytes_new (message, strlen (message));
+    } else {
+        return TRUE;
+    }
+
+    g_mutex_lock (&sock->lock);
+
+    if (uzbl.io->queue_limit && !(flags & UZBL_IO_FORCE) && !sock->closed &&
+        (uzbl.io->queue_limit < sock->queued_bytes + g_bytes_get_size (bytes))) {
+        switch (uzbl.io->overflow) {
+        case UZBL_IO_OVERFLOW_COALESCE:
+            if ((flags & UZBL_IO_COALESCE) && coalesce_message (sock, bytes)) {
+                break;
+            }
+            /* FALLTHROUGH */
+        case UZBL_IO_OVERFLOW_DROP:
+            ++sock->events_dropped;
+            g_mutex_unlock (&sock->lock);
+            g_bytes_unref (bytes);
+            return TRUE;
+        case UZBL_IO_OVERFLOW_BLOCK:
+            wait_for_room (sock, g_bytes_get_size (bytes));
+            break;
+        case UZBL_IO_OVERFLOW_DISCONNECT:
+        default:
+            ++sock->events_dropped;
+            g_mutex_unlock (&sock->lock);
+            g_bytes_unref (bytes);
+            return FALSE;
+        }
+    }
+
+    g_mutex_unlock (&sock->lock);
+
+    ret = queue_bytes (sock, bytes, flags);
+    g_bytes_unref (bytes);
+
+    return ret;
+}
+
+gboolean
+queue_bytes (UzblIOSocket *sock, GBytes *bytes, UzblIOFlags flags)
+{
+    gboolean schedule = FALSE;
+    gboolean defer = FALSE;
+
+    g_mutex_lock (&sock->lock);
+
+    if (sock->closed) {
+        g_mutex_unlock (&sock->lock);
+        return TRUE;
+    }
+
+    if (g_queue_is_empty (&sock->queue)) {
+        sock->queued_since = g_get_monotonic_time ();
+    }
+
+    g_queue_push_tail (&sock->queue, g_bytes_ref (bytes));
+    sock->queued_bytes += g_bytes_get_size (bytes);
+    sock->bytes_queued += g_bytes_get_size (bytes);
+
+    if (!sock->flushing) {
+        if (uzbl.io->batching && !(flags & UZBL_IO_URGENT)) {
+            defer = !sock->deferred;
+        } else {
+            sock->flushing = TRUE;
+            schedule = TRUE;
+        }
+    }
+
+    g_mutex_unlock (&sock->lock);
+
+    if (schedule) {
+        schedule_io (flush_socket, sock);
+    } else if (defer) {
+        defer_socket (sock);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+shutdown_socket (gpointer data);
+
+void
+close_socket (UzblIOSocket *sock)
+{
+    gboolean busy;
+
+    g_mutex_lock (&sock->lock);
+
+    if (sock->closed) {
+        g_mutex_unlock (&sock->lock);
+        return;
+    }
+
+    sock->closed = TRUE;
+    clear_socket_queue (sock);
+    g_cond_broadcast (&sock->drained);
+    /* An in-flight write shuts the socket down once it completes. */
+    busy = (sock->current != NULL);
+
+    g_mutex_unlock (&sock->lock);
+
+    if (!busy) {
+        schedule_io (shutdown_socket, sock);
+    }
+}
+
+void
+clear_socket_queue (UzblIOSocket *sock)
+{
+    GBytes *bytes;
 
-    g_string_append_c (result, '\n');
-    write_to_stream (stream, result->str);
+    while ((bytes = g_queue_pop_head (&sock->queue))) {
+        g_bytes_unref (bytes);
+    }
 
-    g_object_unref (G_OBJECT (stream));
+    sock->queued_bytes = 0;
 }
 
+static void
+write_socket_cb (GObject *source, GAsyncResult *res, gpointer data);
+
 void
-send_buffered_event_to_socket (gpointer event, gpointer data)
+write_to_socket (UzblIOSocket *sock)
 {
-    const gchar *message = (const gchar *)event;
-    GIOStream *stream = G_IO_STREAM (data);
+    GOutputStream *output = g_io_stream_get_output_stream (sock->stream);
+    gsize size;
+    gconstpointer buf = g_bytes_get_data (sock->current, &size);
 
-    write_to_stream (stream, message);
+    g_output_stream_write_all_async (output, buf, size,
+                                     G_PRIORITY_DEFAULT, NULL,
+                                     write_socket_cb, io_socket_ref (sock));
 }
 
 void
-write_to_stream (GIOStream *stream, const gchar *message)
+wait_for_room (UzblIOSocket *sock, gsize size)
 {
-    GError *error = NULL;
-    gssize ret;
-    GOutputStream *output = g_io_stream_get_output_stream (stream);
+    gint64 start;
 
-    if (!output || g_output_stream_is_closed (output)) {
+    /* The I/O thread cannot wait for itself; the message is queued past the
+     * limit instead. */
+    if (g_thread_self () != uzbl.io->main_thread) {
         return;
     }
 
-    ret = g_output_stream_write (output, message, strlen (message),
-                                 NULL, &error);
+    /* Make sure the queue is on its way out (it may be waiting on a batch). */
+    if (!sock->flushing) {
+        sock->flushing = TRUE;
+        schedule_io (flush_socket, sock);
+    }
+
+    start = g_get_monotonic_time ();
+
+    while (!sock->closed && sock->queued_bytes &&
+           (uzbl.io->queue_limit < sock->queued_bytes + size)) {
+        g_cond_wait (&sock->drained, &sock->lock);
+    }
 
-    if (ret == -1) {
+    sock->blocked_time += g_get_monotonic_time () - start;
+}
+
+void
+append_socket_stats_one (gpointer data, gpointer user_data)
+{
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+    GString *result = (GString *)user_data;
+
+    g_mutex_lock (&sock->lock);
+    g_string_append_printf (result,
+        "{\"type\": \"%s\", "
+        "\"queued_events\": %u, "
+        "\"queued_bytes\": %" G_GSIZE_FORMAT ", "
+        "\"written_events\": %" G_GUINT64_FORMAT ", "
+        "\"written_bytes\": %" G_GUINT64_FORMAT ", "
+        "\"total_queued_bytes\": %" G_GUINT64_FORMAT ", "
+        "\"dropped_events\": %" G_GUINT64_FORMAT ", "
+        "\"max_latency\": %" G_GINT64_FORMAT ", "
+        "\"blocked_time\": %" G_GINT64_FORMAT ", "
+        "\"framing\": \"%s\"}",
+        sock->kind,
+        g_queue_get_length (&sock->queue),
+        sock->queued_bytes,
+        sock->events_written,
+        sock->bytes_written,
+        sock->bytes_queued,
+        sock->events_dropped,
+        sock->max_latency,
+        sock->blocked_time,
+        (sock->framing == UZBL_IO_FRAMING_BINARY) ? "binary" : "text");
+    g_mutex_unlock (&sock->lock);
+}
+
+static gsize
+event_key_length (const gchar *message, gsize size);
+static gsize
+frame_key_length (const gchar *frame, gsize size);
+
+gboolean
+coalesce_message (UzblIOSocket *sock, GBytes *message)
+{
+    gsize message_size;
+    const gchar *data = g_bytes_get_data (message, &message_size);
+    gsize key_start = 0;
+    gsize key_end;
+    GList *link;
+
+    if (sock->framing == UZBL_IO_FRAMING_BINARY) {
+        /* Skip the length prefix. */
+        key_start = sizeof (guint32);
+        key_end = frame_key_length (data, message_size);
+    } else {
+        /* Include the space after the name. */
+        key_end = event_key_length (data, message_size) + 1;
+    }
+
+    if (key_end <= key_start || message_size < key_end) {
+        return FALSE;
+    }
+
+    /* Replace the newest pending event with the same name. */
+    for (link = sock->queue.tail; link; link = link->prev) {
+        GBytes *bytes = (GBytes *)link->data;
+        gsize size;
+        const gchar *pending = g_bytes_get_data (bytes, &size);
+
+        if ((key_end <= size) && !memcmp (pending + key_start, data + key_start, key_end - key_start)) {
+            sock->queued_bytes -= size;
+            ++sock->events_dropped;
+
+            g_bytes_unref (bytes);
+            g_queue_delete_link (&sock->queue, link);
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void
+schedule_io (GSourceFunc func, UzblIOSocket *sock)
+{
+    GSource *source = g_idle_source_new ();
+
+    g_source_set_callback (source, func, io_socket_ref (sock), io_socket_unref);
+    g_source_attach (source, uzbl.io->io_ctx);
+    g_source_unref (source);
+}
+
+static gboolean
+flush_batch (gpointer data);
+
+void
+defer_socket (UzblIOSocket *sock)
+{
+    sock->deferred = TRUE;
+    g_ptr_array_add (uzbl.io->batch, io_socket_ref (sock));
+
+    if (uzbl.io->batch_idle) {
+        return;
+    }
+
+    /* Flush once the main loop has nothing better to do... */
+    uzbl.io->batch_idle = g_idle_source_new ();
+    g_source_set_priority (uzbl.io->batch_idle, G_PRIORITY_DEFAULT_IDLE);
+    g_source_set_callback (uzbl.io->batch_idle, flush_batch, NULL, NULL);
+    g_source_attach (uzbl.io->batch_idle, NULL);
+
+    /* ...but do not wait longer than the window for it. */
+    uzbl.io->batch_timeout = g_timeout_source_new (0);
+    g_source_set_ready_time (uzbl.io->batch_timeout,
+                             g_get_monotonic_time () + uzbl.io->batch_window);
+    g_source_set_callback (uzbl.io->batch_timeout, flush_batch, NULL, NULL);
+    g_source_attach (uzbl.io->batch_timeout, NULL);
+}
+
+static void
+release_socket (gpointer data, gpointer user_data);
+
+gboolean
+flush_batch (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    g_ptr_array_foreach (uzbl.io->batch, release_socket, NULL);
+    g_ptr_array_set_size (uzbl.io->batch, 0);
+
+    /* Whichever source fired, the other one is no longer needed. */
+    cancel_batch ();
+
+    return FALSE;
+}
+
+void
+cancel_batch ()
+{
+    if (uzbl.io->batch_idle) {
+        g_source_destroy (uzbl.io->batch_idle);
+        g_source_unref (uzbl.io->batch_idle);
+        uzbl.io->batch_idle = NULL;
+    }
+
+    if (uzbl.io->batch_timeout) {
+        g_source_destroy (uzbl.io->batch_timeout);
+        g_source_unref (uzbl.io->batch_timeout);
+        uzbl.io->batch_timeout = NULL;
+    }
+}
+
+void
+release_socket (gpointer data, gpointer user_data)
+{
+    UZBL_UNUSED (user_data);
+
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+    gboolean schedule = FALSE;
+
+    sock->deferred = FALSE;
+
+    g_mutex_lock (&sock->lock);
+
+    if (!sock->closed && !sock->flushing && !g_queue_is_empty (&sock->queue)) {
+        sock->flushing = TRUE;
+        schedule = TRUE;
+    }
+
+    g_mutex_unlock (&sock->lock);
+
+    if (schedule) {
+        schedule_io (flush_socket, sock);
+    }
+}
+
+static void
+take_queue (UzblIOSocket *sock);
+
+/* Runs in the I/O thread. */
+gboolean
+flush_socket (gpointer data)
+{
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+
+    g_mutex_lock (&sock->lock);
+
+    if (sock->closed || g_queue_is_empty (&sock->queue)) {
+        sock->flushing = FALSE;
+        g_mutex_unlock (&sock->lock);
+        return FALSE;
+    }
+
+    take_queue (sock);
+
+    g_mutex_unlock (&sock->lock);
+
+    write_to_socket (sock);
+
+    return FALSE;
+}
+
+void
+take_queue (UzblIOSocket *sock)
+{
+    GByteArray *batch;
+    GBytes *bytes;
+
+    sock->current_events = g_queue_get_length (&sock->queue);
+    sock->current_since = sock->queued_since;
+
+    /* Senders waiting for room may go ahead. */
+    g_cond_broadcast (&sock->drained);
+
+    if (sock->current_events == 1) {
+        sock->current = g_queue_pop_head (&sock->queue);
+        sock->queued_bytes = 0;
+        return;
+    }
+
+    /* Gather everything pending into a single write. */
+    batch = g_byte_array_sized_new (sock->queued_bytes);
+
+    while ((bytes = g_queue_pop_head (&sock->queue))) {
+        gsize size;
+        gconstpointer buf = g_bytes_get_data (bytes, &size);
+
+        g_byte_array_append (batch, buf, size);
+        g_bytes_unref (bytes);
+    }
+
+    sock->current = g_byte_array_free_to_bytes (batch);
+    sock->queued_bytes = 0;
+}
+
+/* Runs in the I/O thread. */
+gboolean
+shutdown_socket (gpointer data)
+{
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+    GError *error = NULL;
+
+    if (!g_io_stream_close (sock->stream, NULL, &error)) {
+        g_warning ("Error shutting down %s socket: %s", sock->kind, error->message);
+        g_clear_error (&error);
+    }
+
+    return FALSE;
+}
+
+/* Runs in the I/O thread. */
+void
+write_socket_cb (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UzblIOSocket *sock = (UzblIOSocket *)data;
+    GError *error = NULL;
+    gsize written = 0;
+    gboolean closed;
+
+    if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (source), res, &written, &error)) {
         g_warning ("Error writing: %s", error->message);
         g_clear_error (&error);
+    }
+
+    g_mutex_lock (&sock->lock);
+
+    if (written == g_bytes_get_size (sock->current)) {
+        sock->events_written += sock->current_events;
+        sock->max_latency = MAX (sock->max_latency,
+                                 g_get_monotonic_time () - sock->current_since);
+    }
+    sock->bytes_written += written;
+
+    g_bytes_unref (sock->current);
+    sock->current = NULL;
+
+    closed = sock->closed;
+    if (closed) {
+        sock->flushing = FALSE;
+    }
+
+    g_mutex_unlock (&sock->lock);
+
+    if (closed) {
+        shutdown_socket (sock);
     } else {
-        if (!g_output_stream_flush (output, NULL, &error)) {
-            g_warning ("Error flushing: %s", error->message);
-            g_clear_error (&error);
+        flush_socket (sock);
+    }
+
+    io_socket_unref (sock);
+}
+
+gsize
+event_key_length (const gchar *message, gsize size)
+{
+    const gchar *p = message;
+    const gchar *end = message + size;
+    guint spaces = 0;
+
+    /* The key is the "EVENT [instance] NAME" prefix of the message. */
+    while ((p < end) && (*p != '\n')) {
+        if ((*p == ' ') && (++spaces == 3)) {
+            break;
         }
+        ++p;
     }
+
+    return p - message;
+}
+
+gsize
+frame_key_length (const gchar *frame, gsize size)
+{
+    gsize offset = sizeof (guint32);
+    guint i;
+
+    /* The key is the directive, instance and name strings of the frame. */
+    for (i = 0; i < 3; ++i) {
+        guint32 len;
+
+        if (size < offset + sizeof (len)) {
+            return 0;
+        }
+
+        memcpy (&len, frame + offset, sizeof (len));
+        offset += sizeof (len) + GUINT32_FROM_BE (len);
+    }
+
+    return (offset <= size) ? offset : 0;
 }
 
 void
@@ -793,13 +2328,20 @@ accept_socket_cb (GObject *source, GAsyncResult *res, gpointer data)
     if (!con) {
         g_warning ("Failed to accept client %s", error->message);
         g_error_free (error);
+    } else {
+        UzblIOSocket *sock = io_socket_new (G_IO_STREAM (con),
+                                            uzbl.io->client_sockets, "client");
+
+        add_buffered_cmd_source (G_IO_STREAM (con), "Uzbl control socket",
+                                 control_command_stream, close_client_socket,
+                                 sock);
+        g_mutex_lock (&uzbl.io->sockets_lock);
+        g_ptr_array_add (uzbl.io->client_sockets, io_socket_ref (sock));
+        g_mutex_unlock (&uzbl.io->sockets_lock);
+        update_event_mask ();
+        g_object_unref (con);
     }
 
-    add_buffered_cmd_source (G_IO_STREAM (con), "Uzbl control socket",
-                             control_command_stream, close_client_socket,
-                             uzbl.io->client_sockets);
-    g_ptr_array_add (uzbl.io->client_sockets, G_IO_STREAM (con));
-
     g_socket_listener_accept_async (listener, NULL,
                                     accept_socket_cb, NULL);
 }
@@ -2,20 +2,89 @@
 #define UZBL_IO_H
 
 #include "commands.h"
+#include "events.h"
 
 #include <glib.h>
 
+typedef enum {
+    /* Only send to --connect-socket sockets. */
+    UZBL_IO_CONNECT_ONLY = 1 << 0,
+    /* Newer copies of the message may replace older, unsent ones. */
+    UZBL_IO_COALESCE     = 1 << 1,
+    /* Never drop the message. */
+    UZBL_IO_FORCE        = 1 << 2,
+    /* Send the message (and anything before it) without batching. */
+    UZBL_IO_URGENT       = 1 << 3
+} UzblIOFlags;
+
+typedef enum {
+    /* Newline-terminated text messages. */
+    UZBL_IO_FRAMING_TEXT   = 1 << 0,
+    /* Length-prefixed binary frames (see comm.h). */
+    UZBL_IO_FRAMING_BINARY = 1 << 1
+} UzblIOFraming;
+
+typedef enum {
+    UZBL_IO_OVERFLOW_DROP,
+    UZBL_IO_OVERFLOW_COALESCE,
+    UZBL_IO_OVERFLOW_BLOCK,
+    UZBL_IO_OVERFLOW_DISCONNECT
+} UzblIOOverflow;
+
+/* May be called from any thread. */
 void
-uzbl_io_send (const gchar *message, gboolean connect_only);
+uzbl_io_send (const gchar *message, UzblIOFlags flags);
+void
+uzbl_io_send_event (UzblEventType type, const gchar *message, GBytes *frame, UzblIOFlags flags);
+UzblIOFraming
+uzbl_io_event_wanted (UzblEventType type);
+gboolean
+uzbl_io_subscribe (const UzblEventMask *mask);
+gboolean
+uzbl_io_set_framing (UzblIOFraming framing);
 
 typedef void (*UzblIOCallback)(GString *result, gpointer data);
 
 void
 uzbl_io_schedule_command (const UzblCommand *cmd, GArray *argv, UzblIOCallback callback, gpointer data);
 
+/* A command result which is delivered later. */
+typedef struct _UzblIOPending UzblIOPending;
+
+UzblIOPending *
+uzbl_io_defer_result (GString *result);
+void
+uzbl_io_complete_result (UzblIOPending *pending, const gchar *result);
+
 gboolean
 uzbl_io_init_fifo (const gchar *dir);
 gboolean
 uzbl_io_init_socket (const gchar *dir);
 
+void
+uzbl_io_set_queue_limit (gsize limit);
+gsize
+uzbl_io_get_queue_limit ();
+void
+uzbl_io_set_overflow (UzblIOOverflow overflow);
+UzblIOOverflow
+uzbl_io_get_overflow ();
+void
+uzbl_io_set_batching (gboolean batching);
+gboolean
+uzbl_io_get_batching ();
+void
+uzbl_io_set_batch_window (gint64 window);
+gint64
+uzbl_io_get_batch_window ();
+guint64
+uzbl_io_get_buffer_dropped ();
+void
+uzbl_io_set_print_events (gboolean print_events);
+gboolean
+uzbl_io_get_print_events ();
+
+void
+uzbl_io_dump_stats (GString *result);
+
 #endif
@@ -9,11 +9,24 @@
 #include <errno.h>
 #include <string.h>
 
+typedef struct {
+    gchar *cookie;
+
+    /* Set once the reply arrives (or the request times out). */
+    GString  *reply;
+    gboolean  done;
+
+    /* Asynchronous requests only. */
+    UzblRequestCallback  callback;
+    gpointer             data;
+    guint                timeout;
+} UzblRequest;
+
 struct _UzblRequests {
-    /* Reply buffer */
-    GCond   reply_cond;
-    GMutex  reply_lock;
-    gchar  *reply;
+    /* Outstanding requests, keyed by cookie. */
+    GMutex      lock;
+    GCond       reply_cond;
+    GHashTable *pending;
 };
 
 /* =========================== PUBLIC API =========================== */
@@ -24,42 +37,94 @@ uzbl_requests_init ()
     uzbl.requests = g_malloc (sizeof (UzblRequests));
 
     /* Initialize variables */
-    g_mutex_init (&uzbl.requests->reply_lock);
+    g_mutex_init (&uzbl.requests->lock);
     g_cond_init (&uzbl.requests->reply_cond);
-    uzbl.requests->reply = NULL;
+    uzbl.requests->pending = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
+static gboolean
+take_async_request (gpointer key, gpointer value, gpointer data);
+static void
+fail_request (gpointer data, gpointer user_data);
+
 void
 uzbl_requests_free ()
 {
-    g_mutex_clear (&uzbl.requests->reply_lock);
+    GSList *outstanding = NULL;
+
+    /* Nothing will answer asynchronous requests any more. Those waited on
+     * synchronously still belong to their callers. */
+    g_mutex_lock (&uzbl.requests->lock);
+    g_hash_table_foreach_steal (uzbl.requests->pending, take_async_request, &outstanding);
+    g_mutex_unlock (&uzbl.requests->lock);
+
+    g_slist_foreach (outstanding, fail_request, NULL);
+    g_slist_free (outstanding);
+
+    g_hash_table_unref (uzbl.requests->pending);
+    g_mutex_clear (&uzbl.requests->lock);
     g_cond_clear (&uzbl.requests->reply_cond);
-    g_free (uzbl.requests->reply);
 
     g_free (uzbl.requests);
     uzbl.requests = NULL;
 }
 
+static gboolean
+complete_request (gpointer data);
+
 void
 uzbl_requests_set_reply (const gchar *reply)
 {
-    g_mutex_lock (&uzbl.requests->reply_lock);
-    if (uzbl.requests->reply) {
-        /* Stale reply? It's likely to be old, so let's nuke it. */
-        g_free (uzbl.requests->reply);
+    const gchar *cookie_start;
+    const gchar *cookie_end;
+    gchar *cookie;
+    UzblRequest *req;
+
+    /* Replies look like "REPLY-<cookie> <reply>". */
+    if (!g_str_has_prefix (reply, "REPLY-")) {
+        return;
     }
-    uzbl.requests->reply = g_strdup (reply);
-    g_cond_broadcast (&uzbl.requests->reply_cond);
-    g_mutex_unlock (&uzbl.requests->reply_lock);
-}
 
-typedef struct {
-    GString *request;
-    gchar *cookie;
-} UzblBufferedRequest;
+    cookie_start = reply + strlen ("REPLY-");
+    cookie_end = strchr (cookie_start, ' ');
+    if (!cookie_end) {
+        cookie_end = cookie_start + strlen (cookie_start);
+    }
+
+    cookie = g_strndup (cookie_start, cookie_end - cookie_start);
+
+    g_mutex_lock (&uzbl.requests->lock);
+
+    req = g_hash_table_lookup (uzbl.requests->pending, cookie);
+    if (req) {
+        g_hash_table_remove (uzbl.requests->pending, cookie);
 
+        req->reply = g_string_new (*cookie_end ? cookie_end + 1 : "");
+        req->done = TRUE;
+
+        if (req->callback) {
+            /* Callbacks run on the main thread. */
+            g_idle_add (complete_request, req);
+        } else {
+            g_cond_broadcast (&uzbl.requests->reply_cond);
+        }
+    }
+
+    g_mutex_unlock (&uzbl.requests->lock);
+
+    if (!req) {
+        uzbl_debug ("Ignoring reply to unknown request: %s\n", cookie);
+    }
+
+    g_free (cookie);
+}
+
+static UzblRequest *
+vuzbl_requests_send (const gchar *request, UzblRequestCallback callback, gpointer data, va_list vargs);
 static GString *
-vuzbl_requests_send (gint64 timeout, const gchar *request, const gchar *cookie, va_list vargs);
+wait_for_reply (UzblRequest *req, gint64 timeout);
+static gboolean
+timeout_request (gpointer data);
 
 GString *
 uzbl_requests_send (gint64 timeout, const gchar *request, ...)
@@ -70,81 +135,178 @@ uzbl_requests_send (gint64 timeout, const gchar *request, ...)
     va_start (vargs, request);
     va_copy (vacopy, vargs);
 
-    GString *cookie = g_string_new ("");
-    g_string_printf (cookie, "%u", g_random_int ());
+    UzblRequest *req = vuzbl_requests_send (request, NULL, NULL, vacopy);
+
+    va_end (vacopy);
+    va_end (vargs);
+
+    return wait_for_reply (req, timeout);
+}
+
+void
+uzbl_requests_send_async (gint64 timeout, UzblRequestCallback callback, gpointer data, const gchar *request, ...)
+{
+    va_list vargs;
+    va_list vacopy;
 
-    GString *str = vuzbl_requests_send (timeout, request, cookie->str, vacopy);
+    va_start (vargs, request);
+    va_copy (vacopy, vargs);
 
-    g_string_free (cookie, TRUE);
+    UzblRequest *req = vuzbl_requests_send (request, callback, data, vacopy);
 
     va_end (vacopy);
     va_end (vargs);
 
-    return str;
+    if (0 < timeout) {
+        req->timeout = g_timeout_add_seconds (timeout, timeout_request, req);
+    }
 }
 
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
-static GString *
-send_request_sockets (gint64 timeout, GString *request, const gchar *cookie);
-
-GString *
-vuzbl_requests_send (gint64 timeout, const gchar *request, const gchar *cookie, va_list vargs)
+UzblRequest *
+vuzbl_requests_send (const gchar *request, UzblRequestCallback callback, gpointer data, va_list vargs)
 {
+    UzblRequest *req = g_malloc0 (sizeof (UzblRequest));
+
+    req->callback = callback;
+    req->data = data;
+
+    /* Register the request before it goes out so that the reply cannot be
+     * missed. */
+    g_mutex_lock (&uzbl.requests->lock);
+    do {
+        g_free (req->cookie);
+        req->cookie = g_strdup_printf ("%u", g_random_int ());
+    } while (g_hash_table_contains (uzbl.requests->pending, req->cookie));
+    g_hash_table_insert (uzbl.requests->pending, req->cookie, req);
+    g_mutex_unlock (&uzbl.requests->lock);
+
     GString *request_id = g_string_new ("");
-    g_string_printf (request_id, "REQUEST-%s", cookie);
+    g_string_printf (request_id, "REQUEST-%s", req->cookie);
 
     GString *rq = uzbl_comm_vformat (request_id->str, request, vargs);
-    GString *result = send_request_sockets (timeout, rq, cookie);
+    uzbl_io_send (rq->str, UZBL_IO_CONNECT_ONLY | UZBL_IO_FORCE | UZBL_IO_URGENT);
 
     g_string_free (request_id, TRUE);
     g_string_free (rq, TRUE);
 
-    return result;
+    return req;
 }
 
+static void
+free_request (UzblRequest *req);
+
 GString *
-send_request_sockets (gint64 timeout, GString *msg, const gchar *cookie)
+wait_for_reply (UzblRequest *req, gint64 timeout)
 {
-    uzbl_io_send (msg->str, TRUE);
-
-    /* Require replies within 1 second. */
     gint64 deadline = g_get_monotonic_time () + timeout * G_TIME_SPAN_SECOND;
+    GString *result;
 
-    GString *reply_cookie = g_string_new ("");
-    g_string_printf (reply_cookie, "REPLY-%s ", cookie);
-
-    GString *req_result = g_string_new ("");
-
-    gboolean done = FALSE;
-    do {
-        gboolean timeout = FALSE;
-
-        g_mutex_lock (&uzbl.requests->reply_lock);
-        while (!uzbl.requests->reply) {
-            if (timeout > 0) {
-                if (!g_cond_wait_until (&uzbl.requests->reply_cond, &uzbl.requests->reply_lock, deadline)) {
-                    timeout = TRUE;
-                    break;
-                }
-            } else {
-                g_cond_wait (&uzbl.requests->reply_cond, &uzbl.requests->reply_lock);
+    g_mutex_lock (&uzbl.requests->lock);
+    while (!req->done) {
+        if (timeout > 0) {
+            if (!g_cond_wait_until (&uzbl.requests->reply_cond, &uzbl.requests->lock, deadline)) {
+                break;
             }
+        } else {
+            g_cond_wait (&uzbl.requests->reply_cond, &uzbl.requests->lock);
         }
+    }
 
-        if (timeout) {
-            done = TRUE;
-        } else if (g_str_has_prefix (uzbl.requests->reply, reply_cookie->str)) {
-            g_string_assign (req_result, uzbl.requests->reply + reply_cookie->len);
-            done = TRUE;
-        }
+    if (!req->done) {
+        g_hash_table_remove (uzbl.requests->pending, req->cookie);
+    }
+    g_mutex_unlock (&uzbl.requests->lock);
+
+    result = req->reply ? req->reply : g_string_new ("");
+    req->reply = NULL;
+
+    free_request (req);
 
-        g_free (uzbl.requests->reply);
-        uzbl.requests->reply = NULL;
+    return result;
+}
 
-        g_mutex_unlock (&uzbl.requests->reply_lock);
-    } while (!done);
+gboolean
+complete_request (gpointer data)
+{
+    UzblRequest *req = (UzblRequest *)data;
+
+    if (req->timeout) {
+        g_source_remove (req->timeout);
+    }
+
+    req->callback (req->reply, req->data);
+
+    free_request (req);
+
+    return FALSE;
+}
+
+gboolean
+timeout_request (gpointer data)
+{
+    UzblRequest *req = (UzblRequest *)data;
+    gboolean expired;
+
+    g_mutex_lock (&uzbl.requests->lock);
+    expired = g_hash_table_remove (uzbl.requests->pending, req->cookie);
+    g_mutex_unlock (&uzbl.requests->lock);
+
+    /* The source is destroyed on return. */
+    req->timeout = 0;
+
+    /* The reply won; it is already on its way to the callback. */
+    if (!expired) {
+        return FALSE;
+    }
 
-    g_string_free (reply_cookie, TRUE);
-    return req_result;
+    req->callback (NULL, req->data);
+
+    free_request (req);
+
+    return FALSE;
+}
+
+gboolean
+take_async_request (gpointer key, gpointer value, gpointer data)
+{
+    UZBL_UNUSED (key);
+
+    UzblRequest *req = (UzblRequest *)value;
+    GSList **outstanding = (GSList **)data;
+
+    if (!req->callback) {
+        return FALSE;
+    }
+
+    *outstanding = g_slist_prepend (*outstanding, req);
+
+    return TRUE;
+}
+
+void
+fail_request (gpointer data, gpointer user_data)
+{
+    UZBL_UNUSED (user_data);
+
+    UzblRequest *req = (UzblRequest *)data;
+
+    if (req->timeout) {
+        g_source_remove (req->timeout);
+    }
+
+    req->callback (NULL, req->data);
+
+    free_request (req);
+}
+
+void
+free_request (UzblRequest *req)
+{
+    if (req->reply) {
+        g_string_free (req->reply, TRUE);
+    }
+    g_free (req->cookie);
+    g_free (req);
 }
@@ -3,7 +3,13 @@
 
 #include <glib.h>
 
+/* Called on the main thread with the reply, or NULL if the request timed
+ * out. */
+typedef void (*UzblRequestCallback)(GString *reply, gpointer data);
+
 GString *
 uzbl_requests_send (gint64 timeout, const gchar *request, ...) G_GNUC_NULL_TERMINATED;
+void
+uzbl_requests_send_async (gint64 timeout, UzblRequestCallback callback, gpointer data, const gchar *request, ...) G_GNUC_NULL_TERMINATED;
 
 #endif
@@ -107,7 +107,7 @@ uzbl_scheme_request_send (SoupRequest *request, GCancellable *cancellable, GErro
 
     GString *result = g_string_new ("");
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *cmd = uzbl_commands_parse (command, args);
+    const UzblCommand *cmd = uzbl_commands_parse_cached (command, args);
 
     if (cmd) {
         uzbl_commands_args_append (args, soup_uri_to_string (uri, TRUE));
@@ -36,6 +36,10 @@ uzbl_io_init_connect_socket (const gchar *socket_path);
 void
 uzbl_io_flush_buffer ();
 void
+uzbl_io_set_buffer_size (gsize size);
+void
+uzbl_io_set_buffer_lifetime (guint lifetime);
+void
 uzbl_io_quit ();
 
 void
@@ -36,6 +36,8 @@ uzbl_soup_init (SoupSession *session)
         NULL);
 
     uzbl.net.soup_cookie_jar = uzbl_cookie_jar_new ();
+    uzbl.net.prefetched_hosts = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
 
     soup_session_add_feature (session,
         SOUP_SESSION_FEATURE (uzbl.net.soup_cookie_jar));
@@ -47,6 +49,13 @@ uzbl_soup_init (SoupSession *session)
         NULL);
 }
 
+void
+uzbl_soup_free ()
+{
+    g_hash_table_destroy (uzbl.net.prefetched_hosts);
+    uzbl.net.prefetched_hosts = NULL;
+}
+
 void
 uzbl_soup_disable_builtin_auth (SoupSession *session) {
     g_signal_handler_block ((gpointer) session, uzbl.net.builtin_auth_id);
@@ -57,14 +66,78 @@ uzbl_soup_enable_builtin_auth (SoupSession *session) {
     g_signal_handler_unblock ((gpointer) session, uzbl.net.builtin_auth_id);
 }
 
+/* SOUP_CHECK_VERSION itself is newer than soup_session_prefetch_dns. */
+#ifdef HAVE_LIBSOUP_CHECK_VERSION
+#define HAVE_PREFETCH_DNS
+#endif
+
+#ifdef HAVE_PREFETCH_DNS
+static gboolean
+prefetch_allowed (const gchar *host);
+#endif
+
+void
+uzbl_soup_prefetch (const gchar *uri)
+{
+    SoupURI *soup_uri = soup_uri_new (uri);
+
+    if (!soup_uri) {
+        return;
+    }
+
+#ifdef HAVE_PREFETCH_DNS
+    if (SOUP_URI_VALID_FOR_HTTP (soup_uri) && prefetch_allowed (soup_uri->host)) {
+        uzbl_debug ("Prefetching -> %s\n", soup_uri->host);
+
+        soup_session_prefetch_dns (uzbl.net.soup_session, soup_uri->host,
+            NULL, NULL, NULL);
+    }
+#endif
+
+    soup_uri_free (soup_uri);
+}
+
+typedef struct {
+    UzblSoupHoldCallback callback;
+    gpointer data;
+    GDestroyNotify notify;
+} UzblSoupHold;
+
+static void
+free_hold (gpointer data);
+
+void
+uzbl_soup_hold_message (SoupMessage *msg, UzblSoupHoldCallback callback, gpointer data, GDestroyNotify notify)
+{
+    UzblSoupHold *hold = g_malloc (sizeof (UzblSoupHold));
+
+    hold->callback = callback;
+    hold->data = data;
+    hold->notify = notify;
+
+    g_object_set_data_full (G_OBJECT (msg), "uzbl-hold", hold, free_hold);
+}
+
 void
 request_queued_cb (SoupSession *session,
                    SoupMessage *msg,
                    gpointer     data)
 {
-    UZBL_UNUSED (session);
     UZBL_UNUSED (data);
 
+    UzblSoupHold *hold = g_object_steal_data (G_OBJECT (msg), "uzbl-hold");
+
+    /* The message cannot be paused any earlier. */
+    if (hold) {
+        soup_session_pause_message (session, msg);
+        hold->callback (session, msg, hold->data);
+        g_free (hold);
+    }
+
+    if (!uzbl_events_listening (REQUEST_QUEUED)) {
+        return;
+    }
+
     gchar *str = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
 
     uzbl_events_send (REQUEST_QUEUED, NULL,
@@ -85,13 +158,15 @@ request_started_cb (SoupSession *session,
     UZBL_UNUSED (session);
     UZBL_UNUSED (data);
 
-    gchar *str = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
+    if (uzbl_events_listening (REQUEST_STARTING)) {
+        gchar *str = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
 
-    uzbl_events_send (REQUEST_STARTING, NULL,
-        TYPE_STR, str,
-        NULL);
+        uzbl_events_send (REQUEST_STARTING, NULL,
+            TYPE_STR, str,
+            NULL);
 
-    g_free (str);
+        g_free (str);
+    }
 
     g_object_connect (G_OBJECT (msg),
         "signal::finished", G_CALLBACK (request_finished_cb), NULL,
@@ -103,6 +178,10 @@ request_finished_cb (SoupMessage *msg, gpointer data)
 {
     UZBL_UNUSED (data);
 
+    if (!uzbl_events_listening (REQUEST_FINISHED)) {
+        return;
+    }
+
     gchar *str = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
 
     uzbl_events_send (REQUEST_FINISHED, NULL,
@@ -112,6 +191,74 @@ request_finished_cb (SoupMessage *msg, gpointer data)
     g_free (str);
 }
 
+#ifdef HAVE_PREFETCH_DNS
+typedef struct {
+    gint64 since;
+    gint count;
+} UzblPrefetchHost;
+
+/* Forget about hosts rather than growing without bound. */
+#define UZBL_PREFETCH_HOSTS 256
+
+gboolean
+prefetch_allowed (const gchar *host)
+{
+    gint rate = uzbl_variables_get_int_id (UZBL_VARIABLE_PREFETCH_RATE);
+    gint budget = uzbl_variables_get_int_id (UZBL_VARIABLE_PREFETCH_HOST_BUDGET);
+    gint64 now = g_get_monotonic_time ();
+
+    /* No more than prefetch_rate hosts each second... */
+    if (G_TIME_SPAN_SECOND <= (now - uzbl.net.prefetch_window)) {
+        uzbl.net.prefetch_window = now;
+        uzbl.net.prefetch_count = 0;
+    }
+
+    if ((rate <= 0) || ((guint)rate <= uzbl.net.prefetch_count)) {
+        return FALSE;
+    }
+
+    /* ...and no host more than prefetch_host_budget times each minute. */
+    UzblPrefetchHost *entry = g_hash_table_lookup (uzbl.net.prefetched_hosts, host);
+
+    if (entry && (G_TIME_SPAN_MINUTE <= (now - entry->since))) {
+        entry->since = now;
+        entry->count = 0;
+    }
+
+    if (!entry) {
+        if (UZBL_PREFETCH_HOSTS <= g_hash_table_size (uzbl.net.prefetched_hosts)) {
+            g_hash_table_remove_all (uzbl.net.prefetched_hosts);
+        }
+
+        entry = g_malloc0 (sizeof (UzblPrefetchHost));
+        entry->since = now;
+
+        g_hash_table_insert (uzbl.net.prefetched_hosts, g_strdup (host), entry);
+    }
+
+    if (budget <= entry->count) {
+        return FALSE;
+    }
+
+    ++entry->count;
+    ++uzbl.net.prefetch_count;
+
+    return TRUE;
+}
+#endif
+
+void
+free_hold (gpointer data)
+{
+    UzblSoupHold *hold = (UzblSoupHold *)data;
+
+    if (hold->notify) {
+        hold->notify (hold->data);
+    }
+
+    g_free (hold);
+}
+
 typedef struct {
     SoupSession *session;
     SoupMessage *message;
@@ -130,14 +277,14 @@ authenticate_cb (SoupSession *session,
 {
     UZBL_UNUSED (data);
 
-    if (uzbl_variables_get_int ("enable_builtin_auth")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_ENABLE_BUILTIN_AUTH)) {
         return;
     }
 
-    gchar *handler = uzbl_variables_get_string ("authentication_handler");
+    gchar *handler = uzbl_variables_get_string_id (UZBL_VARIABLE_AUTHENTICATION_HANDLER);
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *authentication_command = uzbl_commands_parse (handler, args);
+    const UzblCommand *authentication_command = uzbl_commands_parse_cached (handler, args);
     g_free (handler);
 
     if (!authentication_command) {
@@ -5,6 +5,8 @@
 
 void
 uzbl_soup_init (SoupSession *session);
+void
+uzbl_soup_free ();
 
 void
 uzbl_soup_disable_builtin_auth (SoupSession *session);
@@ -12,4 +14,16 @@ uzbl_soup_disable_builtin_auth (SoupSession *session);
 void
 uzbl_soup_enable_builtin_auth (SoupSession *session);
 
+/* Resolve the host of the URI ahead of time, within the prefetch limits. */
+void
+uzbl_soup_prefetch (const gchar *uri);
+
+/* Called once the message is queued, paused, and may be decided upon. */
+typedef void (*UzblSoupHoldCallback)(SoupSession *session, SoupMessage *msg, gpointer data);
+
+/* Pause the message as soon as it is queued and hand it to the callback. If
+ * the message is never queued, data is released with notify. */
+void
+uzbl_soup_hold_message (SoupMessage *msg, UzblSoupHoldCallback callback, gpointer data, GDestroyNotify notify);
+
 #endif
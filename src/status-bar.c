@@ -22,6 +22,11 @@ uzbl_status_bar_update_left (GtkWidget *widget,  const gchar *format)
         return;
     }
 
+    /* Avoid relayouts when nothing changed. */
+    if (!g_strcmp0 (gtk_label_get_label (GTK_LABEL (status_bar->left_label)), format)) {
+        return;
+    }
+
     gtk_label_set_markup (GTK_LABEL (status_bar->left_label), format);
 }
 
@@ -34,6 +39,11 @@ uzbl_status_bar_update_right (GtkWidget *widget, const gchar *format)
         return;
     }
 
+    /* Avoid relayouts when nothing changed. */
+    if (!g_strcmp0 (gtk_label_get_label (GTK_LABEL (status_bar->right_label)), format)) {
+        return;
+    }
+
     gtk_label_set_markup (GTK_LABEL (status_bar->right_label), format);
 }
 
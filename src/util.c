@@ -100,3 +100,70 @@ find_existing_file_options (gchar *dirs, const gchar *basename)
 
     return path;
 }
+
+static gint
+compare_names (const gchar *a, gsize a_len, const gchar *b);
+static gint
+compare_entries (gconstpointer a, gconstpointer b);
+
+GPtrArray *
+name_table_new (gconstpointer table, gsize stride)
+{
+    GPtrArray *sorted = g_ptr_array_new ();
+    const gchar *entry = (const gchar *)table;
+
+    while (*(const gchar * const *)entry) {
+        g_ptr_array_add (sorted, (gpointer)entry);
+        entry += stride;
+    }
+
+    g_ptr_array_sort (sorted, compare_entries);
+
+    return sorted;
+}
+
+gpointer
+name_table_lookup (const GPtrArray *sorted, const gchar *name)
+{
+    gsize len = strlen (name);
+    guint lo = 0;
+    guint hi = sorted->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        gpointer entry = g_ptr_array_index (sorted, mid);
+        gint cmp = compare_names (name, len, *(const gchar **)entry);
+
+        if (!cmp) {
+            return entry;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+gint
+compare_names (const gchar *a, gsize a_len, const gchar *b)
+{
+    gsize b_len = strlen (b);
+
+    if (a_len != b_len) {
+        return (a_len < b_len) ? -1 : 1;
+    }
+
+    return memcmp (a, b, a_len);
+}
+
+gint
+compare_entries (gconstpointer a, gconstpointer b)
+{
+    /* Sorting passes pointers to the array's elements. */
+    const gchar *a_name = **(const gchar ***)a;
+    const gchar *b_name = **(const gchar ***)b;
+
+    return compare_names (a_name, strlen (a_name), b_name);
+}
@@ -35,3 +35,11 @@ find_existing_file (const gchar *path_list);
  * NOTE: this function modifies the 'dirs' argument. */
 gchar *
 find_existing_file_options (gchar *dirs, const gchar *basename);
+
+/* Builtin tables are arrays of entries which start with their name and end
+ * with a NULL name. This returns the entries ordered by name length and then
+ * by name so that a lookup only ever compares names of the same length. */
+GPtrArray *
+name_table_new (gconstpointer table, gsize stride);
+gpointer
+name_table_lookup (const GPtrArray *sorted, const gchar *name);
@@ -32,6 +32,7 @@
 #include "commands.h"
 #include "config.h"
 #include "events.h"
+#include "filter.h"
 #include "gui.h"
 #include "io.h"
 #include "setup.h"
@@ -66,6 +67,8 @@ uzbl_init (int *argc, char ***argv)
     gboolean verbose = FALSE;
     gchar *config_file = NULL;
     gchar **connect_socket_names = NULL;
+    gint event_buffer_size = -1;
+    gint event_buffer_lifetime = -1;
     gboolean print_events = FALSE;
     gchar *geometry = NULL;
     gboolean print_version = FALSE;
@@ -85,6 +88,10 @@ uzbl_init (int *argc, char ***argv)
             "Xembed socket ID, this window should embed itself",                                             "SOCKET" },
         { "connect-socket",     0,  0, G_OPTION_ARG_STRING_ARRAY, &connect_socket_names,
             "Connect to server socket for event managing",                                                   "CSOCKET" },
+        { "event-buffer-size",  0,  0, G_OPTION_ARG_INT,          &event_buffer_size,
+            "Bytes of early events to replay to event managers (0 disables replay)",                         "BYTES" },
+        { "event-buffer-lifetime", 0, 0, G_OPTION_ARG_INT,        &event_buffer_lifetime,
+            "Seconds to keep early events for replay",                                                       "SECONDS" },
         { "print-events",      'p', 0, G_OPTION_ARG_NONE,         &print_events,
             "Whether to print events to stdout.",                                                            NULL },
         { "geometry",          'g', 0, G_OPTION_ARG_STRING,       &geometry,
@@ -170,11 +177,18 @@ uzbl_init (int *argc, char ***argv)
     uzbl_soup_init (uzbl.net.soup_session);
 
     uzbl_io_init ();
+    if (0 <= event_buffer_size) {
+        uzbl_io_set_buffer_size (event_buffer_size);
+    }
+    if (0 <= event_buffer_lifetime) {
+        uzbl_io_set_buffer_lifetime (event_buffer_lifetime);
+    }
     uzbl_js_init ();
     uzbl_variables_init ();
     uzbl_commands_init ();
     uzbl_events_init ();
     uzbl_requests_init ();
+    uzbl_filter_init ();
 
     uzbl_scheme_init ();
 
@@ -291,6 +305,8 @@ uzbl_free ()
 
     uzbl_inspector_free ();
     uzbl_gui_free ();
+    uzbl_soup_free ();
+    uzbl_filter_free ();
     uzbl_requests_free ();
     uzbl_commands_free ();
     uzbl_variables_free ();
@@ -326,7 +342,7 @@ main (int argc, char *argv[])
     }
 
     /* Verbose feedback. */
-    if (uzbl_variables_get_int ("verbose")) {
+    if (uzbl_variables_get_int_id (UZBL_VARIABLE_VERBOSE)) {
         printf ("Uzbl start location: %s\n", argv[0]);
         if (uzbl.state.xembed_socket_id) {
             printf ("plug_id %d\n", (int)gtk_plug_get_id (uzbl.gui.plug));
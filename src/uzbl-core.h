@@ -57,11 +57,19 @@ typedef struct {
     SoupSession    *soup_session;
     UzblCookieJar  *soup_cookie_jar;
     gulong          builtin_auth_id;
+
+    /* Prefetching limits */
+    GHashTable     *prefetched_hosts;
+    gint64          prefetch_window;
+    guint           prefetch_count;
 } UzblNetwork;
 
 struct _UzblCommands;
 typedef struct _UzblCommands UzblCommands;
 
+struct _UzblFilter;
+typedef struct _UzblFilter UzblFilter;
+
 struct _UzblGui;
 typedef struct _UzblGui UzblGui;
 
@@ -84,6 +92,7 @@ typedef struct {
     UzblNetwork       net;
 
     UzblCommands     *commands;
+    UzblFilter       *filter;
     UzblGui          *gui_;
     UzblInspector    *inspector;
     UzblIO           *io;
@@ -57,24 +57,114 @@ typedef struct {
 struct _UzblVariablesPrivate;
 typedef struct _UzblVariablesPrivate UzblVariablesPrivate;
 
+typedef struct {
+    const char *name;
+    UzblVariable var;
+} UzblVariableEntry;
+
 struct _UzblVariables {
-    /* Table of all variables commands. */
+    /* Builtin variables, and the same sorted for name_table_lookup. */
+    UzblVariableEntry *builtins;
+    GPtrArray *builtin_table;
+
+    /* Variables created by the user. */
     GHashTable *table;
 
+    /* Builtins known to C code by ID, and who to tell when they change. */
+    UzblVariable *by_id[UZBL_VARIABLE_LAST];
+    GSList *watchers[UZBL_VARIABLE_LAST];
+
+    /* Results of expansions with a lifetime, keyed by their command. */
+    GHashTable *expansion_cache;
+
     /* All builtin variable storage is in here. */
     UzblVariablesPrivate *priv;
 };
 
+static const char *
+variable_id_table[] = {
+#define variable_id_string(id, name) #name
+
+    UZBL_VARIABLE_IDS (variable_id_string)
+
+#undef variable_id_string
+};
+
+typedef struct {
+    UzblVariableNotify callback;
+    gpointer data;
+} UzblVariableWatcher;
+
+typedef enum {
+    TOKEN_TEXT,
+    TOKEN_VAR,
+    TOKEN_SHELL,
+    TOKEN_UZBL,
+    TOKEN_JS,
+    TOKEN_ESCAPE
+} UzblTokenType;
+
+typedef struct {
+    UzblTokenType type;
+
+    /* Literal text: a span of the template's source. */
+    gsize start;
+    gsize length;
+
+    /* Variables are resolved once they exist. */
+    gchar *name;
+    UzblVariable *var;
+
+    /* Expansions which run something: whether the body starts with a '+',
+     * the JavaScript context and the (compiled) body. */
+    gboolean plus;
+    const gchar *js_ctx;
+    UzblTemplate *body;
+
+    /* Commands prefixed with "~<SECONDS> " reuse their result for that
+     * long. */
+    gint ttl;
+} UzblToken;
+
+typedef struct {
+    gchar *value;
+    gint64 ttl;
+    gint64 expires;
+    gboolean strip;
+    gboolean refreshing;
+} UzblCachedExpansion;
+
+/* Cleared when it grows past this many entries. */
+#define UZBL_EXPANSION_CACHE_SIZE 64
+
+struct _UzblTemplate {
+    gchar *source;
+    GArray *tokens;
+
+    /* The names of the variables the output depends on and whether it runs
+     * anything (and may therefore depend on anything). */
+    GPtrArray *deps;
+    gboolean dynamic;
+
+    /* Reused for every render. */
+    GString *scratch;
+    gboolean rendering;
+};
+
 /* =========================== PUBLIC API =========================== */
 
 static UzblVariablesPrivate *
-uzbl_variables_private_new (GHashTable *table);
+uzbl_variables_private_new (UzblVariables *variables);
 static void
 uzbl_variables_private_free (UzblVariablesPrivate *priv);
 static void
+variable_clear (UzblVariable *variable);
+static void
 variable_free (UzblVariable *variable);
 static void
 init_js_variables_api ();
+static void
+free_cached_expansion (gpointer data);
 
 void
 uzbl_variables_init ()
@@ -84,7 +174,20 @@ uzbl_variables_init ()
     uzbl.variables->table = g_hash_table_new_full (g_str_hash, g_str_equal,
         g_free, (GDestroyNotify)variable_free);
 
-    uzbl.variables->priv = uzbl_variables_private_new (uzbl.variables->table);
+    uzbl.variables->expansion_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_cached_expansion);
+
+    uzbl.variables->priv = uzbl_variables_private_new (uzbl.variables);
+
+    guint i;
+    for (i = 0; i < UZBL_VARIABLE_LAST; ++i) {
+        UzblVariableEntry *entry = name_table_lookup (uzbl.variables->builtin_table, variable_id_table[i]);
+
+        g_assert (entry);
+
+        uzbl.variables->by_id[i] = &entry->var;
+        uzbl.variables->watchers[i] = NULL;
+    }
 
     init_js_variables_api ();
 }
@@ -93,6 +196,21 @@ void
 uzbl_variables_free ()
 {
     g_hash_table_destroy (uzbl.variables->table);
+    g_hash_table_destroy (uzbl.variables->expansion_cache);
+
+    guint i;
+    for (i = 0; i < UZBL_VARIABLE_LAST; ++i) {
+        g_slist_free_full (uzbl.variables->watchers[i], g_free);
+    }
+
+    UzblVariableEntry *entry = uzbl.variables->builtins;
+    while (entry->name) {
+        variable_clear (&entry->var);
+        ++entry;
+    }
+
+    g_ptr_array_free (uzbl.variables->builtin_table, TRUE);
+    g_free (uzbl.variables->builtins);
 
     uzbl_variables_private_free (uzbl.variables->priv);
 
@@ -130,6 +248,8 @@ static gboolean
 set_variable_double (UzblVariable *var, gdouble d);
 static void
 send_variable_event (const gchar *name, const UzblVariable *var);
+static void
+notify_watchers (const UzblVariable *var);
 
 gboolean
 uzbl_variables_set (const gchar *name, gchar *val)
@@ -374,13 +494,78 @@ typedef enum {
     EXPAND_IGNORE_UZBL
 } UzblExpandStage;
 
+static UzblTemplate *
+compile_template (const gchar *str, UzblExpandStage stage);
+static void
+render_template (UzblTemplate *tmpl, GString *buf);
+static const gchar *
+parse_ttl (const gchar *body, gint *ttl);
+static void
+append_cached (GString *buf, const gchar *cmd, gint ttl, gboolean strip);
 static gchar *
-expand_impl (const gchar *str, UzblExpandStage stage);
+include_line (const gchar *path);
+static void
+free_template (UzblTemplate *tmpl);
 
 gchar *
 uzbl_variables_expand (const gchar *str)
 {
-    return expand_impl (str, EXPAND_INITIAL);
+    UzblTemplate *tmpl = compile_template (str, EXPAND_INITIAL);
+    GString *buf = g_string_new ("");
+
+    render_template (tmpl, buf);
+    free_template (tmpl);
+
+    return g_string_free (buf, FALSE);
+}
+
+gchar *
+uzbl_variables_expand_template (UzblTemplate **tmpl, const gchar *str)
+{
+    UzblTemplate *compiled = *tmpl;
+    gchar *result;
+
+    /* Expanding the format may run commands which expand it again. */
+    if (compiled && compiled->rendering) {
+        return uzbl_variables_expand (str);
+    }
+
+    if (!compiled || g_strcmp0 (compiled->source, str ? str : "")) {
+        free_template (compiled);
+        compiled = *tmpl = compile_template (str, EXPAND_INITIAL);
+    }
+
+    compiled->rendering = TRUE;
+    g_string_truncate (compiled->scratch, 0);
+    render_template (compiled, compiled->scratch);
+    result = g_strndup (compiled->scratch->str, compiled->scratch->len);
+    compiled->rendering = FALSE;
+
+    return result;
+}
+
+gboolean
+uzbl_variables_template_uses (const UzblTemplate *tmpl, const gchar *name)
+{
+    guint i;
+
+    if (!tmpl || tmpl->dynamic) {
+        return TRUE;
+    }
+
+    for (i = 0; i < tmpl->deps->len; ++i) {
+        if (!strcmp (g_ptr_array_index (tmpl->deps, i), name)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void
+uzbl_variables_template_free (UzblTemplate *tmpl)
+{
+    free_template (tmpl);
 }
 
 #define VAR_GETTER(type, name)                     \
@@ -397,13 +582,39 @@ VAR_GETTER (int, int)
 VAR_GETTER (unsigned long long, ull)
 VAR_GETTER (gdouble, double)
 
+gchar *
+uzbl_variables_get_string_id (UzblVariableId id)
+{
+    return get_variable_string (uzbl.variables->by_id[id]);
+}
+
+int
+uzbl_variables_get_int_id (UzblVariableId id)
+{
+    return get_variable_int (uzbl.variables->by_id[id]);
+}
+
+void
+uzbl_variables_connect (UzblVariableId id, UzblVariableNotify callback, gpointer data)
+{
+    UzblVariableWatcher *watcher = g_malloc (sizeof (UzblVariableWatcher));
+
+    watcher->callback = callback;
+    watcher->data = data;
+
+    uzbl.variables->watchers[id] = g_slist_append (uzbl.variables->watchers[id], watcher);
+}
+
 static void
 dump_variable (gpointer key, gpointer value, gpointer data);
 
+static void
+foreach_variable (GHFunc func);
+
 void
 uzbl_variables_dump ()
 {
-    g_hash_table_foreach (uzbl.variables->table, dump_variable, NULL);
+    foreach_variable (dump_variable);
 }
 
 static void
@@ -412,13 +623,13 @@ dump_variable_event (gpointer key, gpointer value, gpointer data);
 void
 uzbl_variables_dump_events ()
 {
-    g_hash_table_foreach (uzbl.variables->table, dump_variable_event, NULL);
+    foreach_variable (dump_variable_event);
 }
 
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
 void
-variable_free (UzblVariable *variable)
+variable_clear (UzblVariable *variable)
 {
     if ((variable->type == TYPE_STR) && variable->value.s && variable->writeable) {
         g_free (*variable->value.s);
@@ -426,10 +637,28 @@ variable_free (UzblVariable *variable)
             g_free (variable->value.s);
         }
     }
+}
+
+void
+variable_free (UzblVariable *variable)
+{
+    variable_clear (variable);
 
     g_free (variable);
 }
 
+void
+foreach_variable (GHFunc func)
+{
+    UzblVariableEntry *entry = uzbl.variables->builtins;
+    while (entry->name) {
+        func ((gpointer)entry->name, &entry->var, NULL);
+        ++entry;
+    }
+
+    g_hash_table_foreach (uzbl.variables->table, func, NULL);
+}
+
 static bool
 js_has_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName);
 static JSValueRef
@@ -479,6 +708,12 @@ init_js_variables_api ()
 UzblVariable *
 get_variable (const gchar *name)
 {
+    UzblVariableEntry *entry = name_table_lookup (uzbl.variables->builtin_table, name);
+
+    if (entry) {
+        return &entry->var;
+    }
+
     return (UzblVariable *)g_hash_table_lookup (uzbl.variables->table, name);
 }
 
@@ -519,9 +754,41 @@ TYPE_SETTER (gdouble, double, d)
 static void
 variable_expand (const UzblVariable *var, GString *buf);
 
+void
+notify_watchers (const UzblVariable *var)
+{
+    guint i;
+
+    if (!var->builtin) {
+        return;
+    }
+
+    for (i = 0; i < UZBL_VARIABLE_LAST; ++i) {
+        if (uzbl.variables->by_id[i] != var) {
+            continue;
+        }
+
+        GSList *l;
+        for (l = uzbl.variables->watchers[i]; l; l = l->next) {
+            UzblVariableWatcher *watcher = (UzblVariableWatcher *)l->data;
+
+            watcher->callback ((UzblVariableId)i, watcher->data);
+        }
+
+        break;
+    }
+}
+
 void
 send_variable_event (const gchar *name, const UzblVariable *var)
 {
+    notify_watchers (var);
+
+    if (!uzbl_events_listening (VARIABLE_SET)) {
+        uzbl_gui_update_variable (name);
+        return;
+    }
+
     GString *str = g_string_new ("");
 
     variable_expand (var, str);
@@ -554,7 +821,7 @@ send_variable_event (const gchar *name, const UzblVariable *var)
 
     g_string_free (str, TRUE);
 
-    uzbl_gui_update_title ();
+    uzbl_gui_update_variable (name);
 }
 
 gchar *
@@ -612,16 +879,25 @@ typedef enum {
 static UzblExpandType
 expand_type (const gchar *str);
 
-gchar *
-expand_impl (const gchar *str, UzblExpandStage stage)
+static void
+append_text_token (UzblTemplate *tmpl, gsize start, gsize length);
+static UzblToken *
+append_token (UzblTemplate *tmpl, UzblTokenType type);
+static void
+collect_dependencies (UzblTemplate *tmpl);
+static gboolean
+variable_is_notified (const gchar *name);
+
+UzblTemplate *
+compile_template (const gchar *str, UzblExpandStage stage)
 {
-    GString *buf = g_string_new ("");
+    UzblTemplate *tmpl = g_malloc0 (sizeof (UzblTemplate));
 
-    if (!str) {
-        return g_string_free (buf, FALSE);
-    }
+    tmpl->source = g_strdup (str ? str : "");
+    tmpl->tokens = g_array_new (FALSE, TRUE, sizeof (UzblToken));
+    tmpl->scratch = g_string_new ("");
 
-    const gchar *p = str;
+    const gchar *p = tmpl->source;
 
     while (*p) {
         switch (*p) {
@@ -630,7 +906,6 @@ expand_impl (const gchar *str, UzblExpandStage stage)
             UzblExpandType etype = expand_type (p);
             char end_char = '\0';
             const gchar *vend = NULL;
-            gchar *ret = NULL;
             ++p;
 
             switch (etype) {
@@ -649,23 +924,23 @@ expand_impl (const gchar *str, UzblExpandStage stage)
                 break;
             case EXPAND_SHELL:
                 end_char = ')';
-                goto expand_impl_find_end;
+                goto compile_template_find_end;
             case EXPAND_UZBL:
                 end_char = '/';
-                goto expand_impl_find_end;
+                goto compile_template_find_end;
             case EXPAND_UZBL_JS:
                 end_char = '*';
-                goto expand_impl_find_end;
+                goto compile_template_find_end;
             case EXPAND_CLEAN_JS:
                 end_char = '-';
-                goto expand_impl_find_end;
+                goto compile_template_find_end;
             case EXPAND_JS:
                 end_char = '>';
-                goto expand_impl_find_end;
+                goto compile_template_find_end;
             case EXPAND_ESCAPE:
                 end_char = ']';
-                goto expand_impl_find_end;
-expand_impl_find_end:
+                goto compile_template_find_end;
+compile_template_find_end:
             {
                 ++p;
                 char end[3] = { end_char, '@', '\0' };
@@ -678,187 +953,509 @@ expand_impl (const gchar *str, UzblExpandStage stage)
             }
             assert (vend);
 
-            ret = g_strndup (p, vend - p);
-
+            gchar *ret = g_strndup (p, vend - p);
+            gboolean plus = (*ret == '+');
             UzblExpandStage ignore = EXPAND_INITIAL;
             const char *js_ctx = "";
+            const gchar *body;
+            UzblToken *token;
 
             switch (etype) {
             case EXPAND_VAR_BRACE:
                 /* Skip the end brace. */
-                ++vend;
+                if (*vend) {
+                    ++vend;
+                }
                 /* FALLTHROUGH */
             case EXPAND_VAR:
-                variable_expand (get_variable (ret), buf);
+                token = append_token (tmpl, TOKEN_VAR);
+                token->var = get_variable (ret);
+                token->name = ret;
+                ret = NULL;
 
                 p = vend;
                 break;
             case EXPAND_SHELL:
-            {
+                /* Left as text (minus the opening) when ignored. */
                 if (stage == EXPAND_IGNORE_SHELL) {
                     break;
                 }
 
-                GString *spawn_ret = g_string_new ("");
-                const gchar *runner = NULL;
-                const gchar *cmd = ret;
-                gboolean quote = FALSE;
-
-                if (*ret == '+') {
-                    /* Execute program directly. */
-                    runner = "spawn_sync";
-                    ++cmd;
-                } else {
-                    /* Execute program through shell, quote it first. */
-                    runner = "spawn_sh_sync";
-                    quote = TRUE;
-                }
-
-                gchar *exp_cmd = expand_impl (cmd, EXPAND_IGNORE_SHELL);
-
-                if (quote) {
-                    gchar *quoted = g_shell_quote (exp_cmd);
-                    g_free (exp_cmd);
-                    exp_cmd = quoted;
-                }
-
-                gchar *full_cmd = g_strdup_printf ("%s %s",
-                    runner,
-                    exp_cmd);
-
-                uzbl_commands_run (full_cmd, spawn_ret);
-
-                g_free (exp_cmd);
-                g_free (full_cmd);
-
-                if (spawn_ret->str) {
-                    remove_trailing_newline (spawn_ret->str);
-
-                    g_string_append (buf, spawn_ret->str);
-                }
-                g_string_free (spawn_ret, TRUE);
-
-                p = vend + 2;
+                /* A '+' executes the program directly rather than through
+                 * the shell. */
+                token = append_token (tmpl, TOKEN_SHELL);
+                body = parse_ttl (ret, &token->ttl);
+                token->plus = (*body == '+');
+                token->body = compile_template (body + (token->plus ? 1 : 0), EXPAND_IGNORE_SHELL);
 
+                p = *vend ? vend + 2 : vend;
                 break;
-            }
             case EXPAND_UZBL:
-            {
                 if (stage == EXPAND_IGNORE_UZBL) {
                     break;
                 }
 
-                GString *uzbl_ret = g_string_new ("");
-
-                GArray *tmp = uzbl_commands_args_new ();
-
-                if (*ret == '+') {
-                    /* Read commands from file. */
-                    gchar *mycmd = expand_impl (ret + 1, EXPAND_IGNORE_UZBL);
-                    g_array_append_val (tmp, mycmd);
-
-                    uzbl_commands_run_argv ("include", tmp, uzbl_ret);
-                } else {
-                    /* Command string. */
-                    gchar *mycmd = expand_impl (ret, EXPAND_IGNORE_UZBL);
-
-                    uzbl_commands_run (mycmd, uzbl_ret);
-                }
-
-                uzbl_commands_args_free (tmp);
-
-                if (uzbl_ret->str) {
-                    g_string_append (buf, uzbl_ret->str);
-                }
-                g_string_free (uzbl_ret, TRUE);
-
-                p = vend + 2;
+                /* A '+' reads commands from a file. */
+                token = append_token (tmpl, TOKEN_UZBL);
+                body = parse_ttl (ret, &token->ttl);
+                token->plus = (*body == '+');
+                token->body = compile_template (body + (token->plus ? 1 : 0), EXPAND_IGNORE_UZBL);
 
+                p = *vend ? vend + 2 : vend;
                 break;
-            }
             case EXPAND_UZBL_JS:
                 ignore = EXPAND_IGNORE_UZBL_JS;
                 js_ctx = "uzbl";
-                goto expand_impl_run_js;
+                goto compile_template_js;
             case EXPAND_CLEAN_JS:
                 ignore = EXPAND_IGNORE_CLEAN_JS;
                 js_ctx = "clean";
-                goto expand_impl_run_js;
+                goto compile_template_js;
             case EXPAND_JS:
                 ignore = EXPAND_IGNORE_JS;
                 js_ctx = "page";
-                goto expand_impl_run_js;
-expand_impl_run_js:
-            {
+                goto compile_template_js;
+compile_template_js:
                 if (stage == ignore) {
                     break;
                 }
 
-                GString *js_ret = g_string_new ("");
+                /* A '+' reads the script from a file. */
+                token = append_token (tmpl, TOKEN_JS);
+                token->plus = plus;
+                token->js_ctx = js_ctx;
+                token->body = compile_template (ret + (plus ? 1 : 0), ignore);
 
-                GArray *tmp = uzbl_commands_args_new ();
-                uzbl_commands_args_append (tmp, g_strdup (js_ctx));
-                const gchar *source = NULL;
-                gchar *cmd = ret;
-
-                if (*ret == '+') {
-                    /* Read JS from file. */
-                    source = "file";
-                    ++cmd;
-                } else {
-                    /* JS from string. */
-                    source = "string";
-                }
+                p = *vend ? vend + 2 : vend;
+                break;
+            case EXPAND_ESCAPE:
+                token = append_token (tmpl, TOKEN_ESCAPE);
+                token->body = compile_template (ret, EXPAND_INITIAL);
 
-                uzbl_commands_args_append (tmp, g_strdup (source));
+                p = *vend ? vend + 2 : vend;
+                break;
+            }
 
-                gchar *exp_cmd = expand_impl (cmd, ignore);
-                g_array_append_val (tmp, exp_cmd);
+            g_free (ret);
+            break;
+        }
+        case '\\':
+            /* The backslash is kept along with the character it escapes. */
+            append_text_token (tmpl, p - tmpl->source, p[1] ? 2 : 1);
+            p += p[1] ? 2 : 1;
+            break;
+        default:
+            append_text_token (tmpl, p - tmpl->source, 1);
+            ++p;
+            break;
+        }
+    }
 
-                uzbl_commands_run_argv ("js", tmp, js_ret);
+    collect_dependencies (tmpl);
 
-                uzbl_commands_args_free (tmp);
+    return tmpl;
+}
 
-                if (js_ret->str) {
-                    g_string_append (buf, js_ret->str);
-                    g_string_free (js_ret, TRUE);
-                }
-                p = vend + 2;
+void
+free_template (UzblTemplate *tmpl)
+{
+    guint i;
 
-                break;
+    if (!tmpl) {
+        return;
+    }
+
+    for (i = 0; i < tmpl->tokens->len; ++i) {
+        UzblToken *token = &g_array_index (tmpl->tokens, UzblToken, i);
+
+        g_free (token->name);
+        free_template (token->body);
+    }
+
+    g_array_free (tmpl->tokens, TRUE);
+    g_ptr_array_free (tmpl->deps, TRUE);
+    g_string_free (tmpl->scratch, TRUE);
+    g_free (tmpl->source);
+    g_free (tmpl);
+}
+
+static gchar *
+render_string (UzblTemplate *tmpl);
+
+void
+render_template (UzblTemplate *tmpl, GString *buf)
+{
+    guint i;
+
+    for (i = 0; i < tmpl->tokens->len; ++i) {
+        UzblToken *token = &g_array_index (tmpl->tokens, UzblToken, i);
+
+        switch (token->type) {
+        case TOKEN_TEXT:
+            g_string_append_len (buf, tmpl->source + token->start, token->length);
+            break;
+        case TOKEN_VAR:
+            if (!token->var) {
+                token->var = get_variable (token->name);
             }
-            case EXPAND_ESCAPE:
-            {
-                gchar *exp_cmd = expand_impl (ret, EXPAND_INITIAL);
-                gchar *escaped = g_markup_escape_text (exp_cmd, strlen (exp_cmd));
 
-                g_string_append (buf, escaped);
+            variable_expand (token->var, buf);
+            break;
+        case TOKEN_SHELL:
+        {
+            GString *spawn_ret;
+            GString *full_cmd = g_string_new ("");
+
+            if (token->plus) {
+                /* Execute program directly. */
+                g_string_append (full_cmd, "spawn_sync ");
+                render_template (token->body, full_cmd);
+            } else {
+                /* Execute program through shell, quote it first. */
+                gchar *exp_cmd = render_string (token->body);
+                gchar *quoted = g_shell_quote (exp_cmd);
+
+                g_string_append (full_cmd, "spawn_sh_sync ");
+                g_string_append (full_cmd, quoted);
 
-                g_free (escaped);
+                g_free (quoted);
                 g_free (exp_cmd);
-                p = vend + 2;
+            }
+
+            if (token->ttl) {
+                append_cached (buf, full_cmd->str, token->ttl, TRUE);
+                g_string_free (full_cmd, TRUE);
                 break;
             }
+
+            spawn_ret = g_string_new ("");
+            uzbl_commands_run (full_cmd->str, spawn_ret);
+
+            g_string_free (full_cmd, TRUE);
+
+            if (spawn_ret->str) {
+                remove_trailing_newline (spawn_ret->str);
+
+                g_string_append (buf, spawn_ret->str);
             }
+            g_string_free (spawn_ret, TRUE);
 
-            g_free (ret);
             break;
         }
-        case '\\':
-            g_string_append_c (buf, *p);
-            ++p;
-            if (!*p) {
+        case TOKEN_UZBL:
+        {
+            GString *uzbl_ret;
+            gchar *mycmd = render_string (token->body);
+
+            if (token->ttl) {
+                gchar *line = token->plus ? include_line (mycmd) : g_strdup (mycmd);
+
+                append_cached (buf, line, token->ttl, FALSE);
+
+                g_free (line);
+                g_free (mycmd);
                 break;
             }
-            /* FALLTHROUGH */
+
+            uzbl_ret = g_string_new ("");
+
+            if (token->plus) {
+                /* Read commands from file. */
+                GArray *tmp = uzbl_commands_args_new ();
+                g_array_append_val (tmp, mycmd);
+
+                uzbl_commands_run_argv ("include", tmp, uzbl_ret);
+
+                uzbl_commands_args_free (tmp);
+            } else {
+                /* Command string. */
+                uzbl_commands_run (mycmd, uzbl_ret);
+
+                g_free (mycmd);
+            }
+
+            if (uzbl_ret->str) {
+                g_string_append (buf, uzbl_ret->str);
+            }
+            g_string_free (uzbl_ret, TRUE);
+
+            break;
+        }
+        case TOKEN_JS:
+        {
+            GString *js_ret = g_string_new ("");
+
+            GArray *tmp = uzbl_commands_args_new ();
+            uzbl_commands_args_append (tmp, g_strdup (token->js_ctx));
+            /* Read JS from file or from the string. */
+            uzbl_commands_args_append (tmp, g_strdup (token->plus ? "file" : "string"));
+            uzbl_commands_args_append (tmp, render_string (token->body));
+
+            uzbl_commands_run_argv ("js", tmp, js_ret);
+
+            uzbl_commands_args_free (tmp);
+
+            if (js_ret->str) {
+                g_string_append (buf, js_ret->str);
+            }
+            g_string_free (js_ret, TRUE);
+
+            break;
+        }
+        case TOKEN_ESCAPE:
+        {
+            gchar *exp_cmd = render_string (token->body);
+            gchar *escaped = g_markup_escape_text (exp_cmd, strlen (exp_cmd));
+
+            g_string_append (buf, escaped);
+
+            g_free (escaped);
+            g_free (exp_cmd);
+            break;
+        }
+        }
+    }
+}
+
+const gchar *
+parse_ttl (const gchar *body, gint *ttl)
+{
+    const gchar *p = body;
+
+    *ttl = 0;
+
+    if (*p != '~' || !g_ascii_isdigit (p[1])) {
+        return body;
+    }
+
+    gint64 seconds = g_ascii_strtoll (p + 1, (gchar **)&p, 10);
+
+    if (!g_ascii_isspace (*p) || (seconds <= 0) || (G_MAXINT < seconds)) {
+        return body;
+    }
+
+    *ttl = seconds;
+
+    while (g_ascii_isspace (*p)) {
+        ++p;
+    }
+
+    return p;
+}
+
+static void
+expansion_refreshed (GString *result, gpointer data);
+
+void
+append_cached (GString *buf, const gchar *cmd, gint ttl, gboolean strip)
+{
+    GHashTable *cache = uzbl.variables->expansion_cache;
+    UzblCachedExpansion *cached = g_hash_table_lookup (cache, cmd);
+    gint64 now = g_get_monotonic_time ();
+
+    if (!cached) {
+        /* The first render has nothing to show without running it. */
+        GString *ret = g_string_new ("");
+
+        uzbl_commands_run (cmd, ret);
+        if (strip) {
+            remove_trailing_newline (ret->str);
+        }
+
+        if (UZBL_EXPANSION_CACHE_SIZE <= g_hash_table_size (cache)) {
+            g_hash_table_remove_all (cache);
+        }
+
+        cached = g_malloc0 (sizeof (UzblCachedExpansion));
+        cached->value = g_strdup (ret->str);
+        cached->ttl = ttl * G_TIME_SPAN_SECOND;
+        cached->expires = now + cached->ttl;
+        cached->strip = strip;
+
+        g_hash_table_insert (cache, g_strdup (cmd), cached);
+
+        g_string_free (ret, TRUE);
+    } else if ((cached->expires <= now) && !cached->refreshing) {
+        /* Show the old value until the new one is in. */
+        cached->refreshing = TRUE;
+        uzbl_commands_run_async (cmd, expansion_refreshed, g_strdup (cmd));
+    }
+
+    g_string_append (buf, cached->value);
+}
+
+void
+expansion_refreshed (GString *result, gpointer data)
+{
+    gchar *cmd = (gchar *)data;
+    UzblCachedExpansion *cached = NULL;
+
+    if (uzbl.variables) {
+        cached = g_hash_table_lookup (uzbl.variables->expansion_cache, cmd);
+    }
+
+    g_free (cmd);
+
+    /* Dropped from the cache while it ran. */
+    if (!cached) {
+        return;
+    }
+
+    cached->refreshing = FALSE;
+    cached->expires = g_get_monotonic_time () + cached->ttl;
+
+    /* Keep the old value if the command failed. */
+    if (!result) {
+        return;
+    }
+
+    if (cached->strip) {
+        remove_trailing_newline (result->str);
+    }
+
+    if (!strcmp (cached->value, result->str)) {
+        return;
+    }
+
+    g_free (cached->value);
+    cached->value = g_strdup (result->str);
+
+    uzbl_gui_update_title ();
+}
+
+gchar *
+include_line (const gchar *path)
+{
+    GString *line = g_string_new ("include ");
+    const gchar *p;
+
+    /* The path is taken literally: protect it from expansion and
+     * unescaping. */
+    for (p = path; *p; ++p) {
+        if ((*p == '\\') || (*p == '@')) {
+            g_string_append_c (line, '\\');
+        }
+        g_string_append_c (line, *p);
+    }
+
+    return g_string_free (line, FALSE);
+}
+
+void
+free_cached_expansion (gpointer data)
+{
+    UzblCachedExpansion *cached = (UzblCachedExpansion *)data;
+
+    g_free (cached->value);
+    g_free (cached);
+}
+
+gchar *
+render_string (UzblTemplate *tmpl)
+{
+    g_string_truncate (tmpl->scratch, 0);
+    render_template (tmpl, tmpl->scratch);
+
+    return g_strndup (tmpl->scratch->str, tmpl->scratch->len);
+}
+
+void
+append_text_token (UzblTemplate *tmpl, gsize start, gsize length)
+{
+    if (tmpl->tokens->len) {
+        UzblToken *last = &g_array_index (tmpl->tokens, UzblToken, tmpl->tokens->len - 1);
+
+        /* Extend the previous span if this one follows it directly. */
+        if ((last->type == TOKEN_TEXT) && (last->start + last->length == start)) {
+            last->length += length;
+            return;
+        }
+    }
+
+    UzblToken *token = append_token (tmpl, TOKEN_TEXT);
+    token->start = start;
+    token->length = length;
+}
+
+void
+collect_dependencies (UzblTemplate *tmpl)
+{
+    guint i;
+    guint j;
+
+    /* The names belong to the tokens (of this template or its bodies). */
+    tmpl->deps = g_ptr_array_new ();
+
+    for (i = 0; i < tmpl->tokens->len; ++i) {
+        UzblToken *token = &g_array_index (tmpl->tokens, UzblToken, i);
+
+        switch (token->type) {
+        case TOKEN_VAR:
+            g_ptr_array_add (tmpl->deps, token->name);
+            if (!variable_is_notified (token->name)) {
+                tmpl->dynamic = TRUE;
+            }
+            break;
+        case TOKEN_SHELL:
+        case TOKEN_UZBL:
+        case TOKEN_JS:
+            tmpl->dynamic = TRUE;
+            break;
         default:
-            g_string_append_c (buf, *p);
-            ++p;
             break;
         }
+
+        if (token->body) {
+            tmpl->dynamic |= token->body->dynamic;
+            for (j = 0; j < token->body->deps->len; ++j) {
+                g_ptr_array_add (tmpl->deps, g_ptr_array_index (token->body->deps, j));
+            }
+        }
     }
+}
 
-    return g_string_free (buf, FALSE);
+/* Constants which are fixed before the GUI exists or whose changes are
+ * reported to uzbl_gui_update_variable. */
+static const gchar *
+notified_constants[] = {
+    "uri",
+    "TITLE",
+    "SELECTED_URI",
+    "NAME",
+    "embedded",
+    NULL
+};
+
+gboolean
+variable_is_notified (const gchar *name)
+{
+    const UzblVariable *var = uzbl.variables ? get_variable (name) : NULL;
+    const gchar **constant;
+
+    /* Setting a variable notifies about it, but getters read state which
+     * changes underneath and most constants change without being set. */
+    if (!var || !var->builtin || (var->writeable && !var->get)) {
+        return TRUE;
+    }
+
+    for (constant = notified_constants; *constant; ++constant) {
+        if (!strcmp (*constant, name)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+UzblToken *
+append_token (UzblTemplate *tmpl, UzblTokenType type)
+{
+    g_array_set_size (tmpl->tokens, tmpl->tokens->len + 1);
+
+    UzblToken *token = &g_array_index (tmpl->tokens, UzblToken, tmpl->tokens->len - 1);
+    token->type = type;
+
+    return token;
 }
 
 void
@@ -1102,9 +1699,16 @@ expand_type (const gchar *str)
     DECLARE_GETTER (type, name);   \
     DECLARE_SETTER (type, name)
 
+/* Uzbl variables */
+DECLARE_GETSET (int, print_events);
+DECLARE_GETSET (int, event_batching);
+DECLARE_GETSET (int, event_batch_window);
+
 /* Communication variables */
 DECLARE_SETTER (gchar *, fifo_dir);
 DECLARE_SETTER (gchar *, socket_dir);
+DECLARE_GETSET (int, event_socket_limit);
+DECLARE_GETSET (gchar *, event_socket_overflow);
 
 /* Handler variables */
 DECLARE_SETTER (int, enable_builtin_auth);
@@ -1297,17 +1901,35 @@ DECLARE_GETTER (int, HAS_WEBKIT2);
 DECLARE_GETTER (gchar *, ARCH_UZBL);
 DECLARE_GETTER (gchar *, COMMIT);
 DECLARE_GETTER (int, PID);
+DECLARE_GETTER (unsigned long long, event_buffer_dropped);
 
 struct _UzblVariablesPrivate {
     /* Uzbl variables */
     gboolean verbose;
     gboolean frozen;
-    gboolean print_events;
     gboolean handle_multi_button;
 
     /* Communication variables */
     gchar *fifo_dir;
     gchar *socket_dir;
+    gchar *shell_cmd;
+    int spawn_timeout;
+    int worker_pool_size;
+    int decision_cache_size;
+    int decision_cache_ttl;
+    int prefetch_on_hover;
+    int prefetch_rate;
+    int prefetch_host_budget;
+
+    /* Handler variables */
+    gchar *navigation_handler;
+    gchar *request_handler;
+    int request_handler_async;
+    gchar *mime_handler;
+    gchar *permission_handler;
+    gchar *download_handler;
+    gchar *file_chooser_handler;
+    gchar *authentication_handler;
 
     /* Window variables */
     gchar *icon;
@@ -1339,13 +1961,8 @@ struct _UzblVariablesPrivate {
     gboolean forward_keys;
 };
 
-typedef struct {
-    const char *name;
-    UzblVariable var;
-} UzblVariableEntry;
-
 UzblVariablesPrivate *
-uzbl_variables_private_new (GHashTable *table)
+uzbl_variables_private_new (UzblVariables *variables)
 {
     UzblVariablesPrivate *priv = g_malloc0 (sizeof (UzblVariablesPrivate));
 
@@ -1355,14 +1972,34 @@ uzbl_variables_private_new (GHashTable *table)
         /* Uzbl variables */
         { "verbose",                      UZBL_V_INT (priv->verbose,                           NULL)},
         { "frozen",                       UZBL_V_INT (priv->frozen,                            NULL)},
-        { "print_events",                 UZBL_V_INT (priv->print_events,                      NULL)},
+        { "print_events",                 UZBL_V_FUNC (print_events,                           INT)},
+        { "event_batching",               UZBL_V_FUNC (event_batching,                         INT)},
+        { "event_batch_window",           UZBL_V_FUNC (event_batch_window,                     INT)},
         { "handle_multi_button",          UZBL_V_INT (priv->handle_multi_button,               NULL)},
 
         /* Communication variables */
         { "fifo_dir",                     UZBL_V_STRING (priv->fifo_dir,                       set_fifo_dir)},
         { "socket_dir",                   UZBL_V_STRING (priv->socket_dir,                     set_socket_dir)},
+        { "event_socket_limit",           UZBL_V_FUNC (event_socket_limit,                     INT)},
+        { "event_socket_overflow",        UZBL_V_FUNC (event_socket_overflow,                  STR)},
+        { "shell_cmd",                    UZBL_V_STRING (priv->shell_cmd,                      NULL)},
+        { "spawn_timeout",                UZBL_V_INT (priv->spawn_timeout,                     NULL)},
+        { "worker_pool_size",             UZBL_V_INT (priv->worker_pool_size,                  NULL)},
+        { "decision_cache_size",          UZBL_V_INT (priv->decision_cache_size,               NULL)},
+        { "decision_cache_ttl",           UZBL_V_INT (priv->decision_cache_ttl,                NULL)},
+        { "prefetch_on_hover",            UZBL_V_INT (priv->prefetch_on_hover,                 NULL)},
+        { "prefetch_rate",                UZBL_V_INT (priv->prefetch_rate,                     NULL)},
+        { "prefetch_host_budget",         UZBL_V_INT (priv->prefetch_host_budget,              NULL)},
 
         /* Handler variables */
+        { "navigation_handler",           UZBL_V_STRING (priv->navigation_handler,             NULL)},
+        { "request_handler",              UZBL_V_STRING (priv->request_handler,                NULL)},
+        { "request_handler_async",        UZBL_V_INT (priv->request_handler_async,             NULL)},
+        { "mime_handler",                 UZBL_V_STRING (priv->mime_handler,                   NULL)},
+        { "permission_handler",           UZBL_V_STRING (priv->permission_handler,             NULL)},
+        { "download_handler",             UZBL_V_STRING (priv->download_handler,               NULL)},
+        { "file_chooser_handler",         UZBL_V_STRING (priv->file_chooser_handler,           NULL)},
+        { "authentication_handler",       UZBL_V_STRING (priv->authentication_handler,         NULL)},
         { "enable_builtin_auth",          UZBL_V_INT (priv->enable_builtin_auth,               set_enable_builtin_auth)},
 
         /* Window variables */
@@ -1565,23 +2202,17 @@ uzbl_variables_private_new (GHashTable *table)
         { "SELECTED_URI",                 UZBL_C_STRING (uzbl.state.selected_url)},
         { "NAME",                         UZBL_C_STRING (uzbl.state.instance_name)},
         { "PID",                          UZBL_C_FUNC (PID,                                    INT)},
+        { "event_buffer_dropped",         UZBL_C_FUNC (event_buffer_dropped,                   ULL)},
         { "_",                            UZBL_C_STRING (uzbl.state.last_result)},
 
         /* Add a terminator entry. */
         { NULL,                           UZBL_SETTING (INT, { .i = NULL }, 0, NULL, NULL)}
     };
 
-    const UzblVariableEntry *entry = builtin_variable_table;
-    while (entry->name) {
-        UzblVariable *value = g_malloc (sizeof (UzblVariable));
-        memcpy (value, &entry->var, sizeof (UzblVariable));
-
-        g_hash_table_insert (table,
-            (gpointer)g_strdup (entry->name),
-            (gpointer)value);
-
-        ++entry;
-    }
+    /* The storage referenced by the table lives in priv; keep a copy of the
+     * table itself. */
+    variables->builtins = g_memdup (builtin_variable_table, sizeof (builtin_variable_table));
+    variables->builtin_table = name_table_new (variables->builtins, sizeof (UzblVariableEntry));
 
     return priv;
 }
@@ -1723,6 +2354,47 @@ inspector ();
 static int
 object_get (GObject *obj, const gchar *prop);
 
+/* Uzbl variables */
+IMPLEMENT_GETTER (int, print_events)
+{
+    return uzbl_io_get_print_events ();
+}
+
+IMPLEMENT_SETTER (int, print_events)
+{
+    uzbl_io_set_print_events (print_events);
+
+    return TRUE;
+}
+
+IMPLEMENT_GETTER (int, event_batching)
+{
+    return uzbl_io_get_batching ();
+}
+
+IMPLEMENT_SETTER (int, event_batching)
+{
+    uzbl_io_set_batching (event_batching);
+
+    return TRUE;
+}
+
+IMPLEMENT_GETTER (int, event_batch_window)
+{
+    return uzbl_io_get_batch_window ();
+}
+
+IMPLEMENT_SETTER (int, event_batch_window)
+{
+    if (event_batch_window < 0) {
+        return FALSE;
+    }
+
+    uzbl_io_set_batch_window (event_batch_window);
+
+    return TRUE;
+}
+
 /* Communication variables */
 IMPLEMENT_SETTER (gchar *, fifo_dir)
 {
@@ -1748,6 +2420,33 @@ IMPLEMENT_SETTER (gchar *, socket_dir)
     return FALSE;
 }
 
+IMPLEMENT_GETTER (int, event_socket_limit)
+{
+    return uzbl_io_get_queue_limit ();
+}
+
+IMPLEMENT_SETTER (int, event_socket_limit)
+{
+    if (event_socket_limit < 0) {
+        return FALSE;
+    }
+
+    uzbl_io_set_queue_limit (event_socket_limit);
+
+    return TRUE;
+}
+
+#define event_socket_overflow_choices(call)          \
+    call (UZBL_IO_OVERFLOW_DROP, "drop")             \
+    call (UZBL_IO_OVERFLOW_COALESCE, "coalesce")     \
+    call (UZBL_IO_OVERFLOW_BLOCK, "block")           \
+    call (UZBL_IO_OVERFLOW_DISCONNECT, "disconnect")
+
+CHOICE_GETSET (UzblIOOverflow, event_socket_overflow,
+               uzbl_io_get_overflow, uzbl_io_set_overflow)
+
+#undef event_socket_overflow_choices
+
 /* Handler variables */
 IMPLEMENT_SETTER (int, enable_builtin_auth)
 {
@@ -2779,6 +3478,11 @@ IMPLEMENT_GETTER (int, PID)
     return (int)getpid ();
 }
 
+IMPLEMENT_GETTER (unsigned long long, event_buffer_dropped)
+{
+    return uzbl_io_get_buffer_dropped ();
+}
+
 GObject *
 webkit_settings ()
 {
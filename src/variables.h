@@ -14,6 +14,63 @@ uzbl_variables_toggle (const gchar *name, GArray *values);
 gchar *
 uzbl_variables_expand (const gchar *str);
 
+/* A format string compiled for repeated expansion. */
+typedef struct _UzblTemplate UzblTemplate;
+
+gchar *
+uzbl_variables_expand_template (UzblTemplate **tmpl, const gchar *str);
+gboolean
+uzbl_variables_template_uses (const UzblTemplate *tmpl, const gchar *name);
+void
+uzbl_variables_template_free (UzblTemplate *tmpl);
+
+/* Builtin variables which C code reads by ID rather than by name. */
+#define UZBL_VARIABLE_IDS(call)                              \
+    call (VERBOSE,                verbose),                \
+    call (FROZEN,                 frozen),                 \
+    call (PRINT_EVENTS,           print_events),           \
+    call (HANDLE_MULTI_BUTTON,    handle_multi_button),    \
+    call (FORWARD_KEYS,           forward_keys),           \
+    call (ENABLE_BUILTIN_AUTH,    enable_builtin_auth),    \
+    call (SHELL_CMD,              shell_cmd),              \
+    call (SPAWN_TIMEOUT,          spawn_timeout),          \
+    call (WORKER_POOL_SIZE,       worker_pool_size),       \
+    call (DECISION_CACHE_SIZE,    decision_cache_size),    \
+    call (DECISION_CACHE_TTL,     decision_cache_ttl),     \
+    call (PREFETCH_ON_HOVER,      prefetch_on_hover),      \
+    call (PREFETCH_RATE,          prefetch_rate),          \
+    call (PREFETCH_HOST_BUDGET,   prefetch_host_budget),   \
+    call (NAVIGATION_HANDLER,     navigation_handler),     \
+    call (REQUEST_HANDLER,        request_handler),        \
+    call (REQUEST_HANDLER_ASYNC,  request_handler_async),  \
+    call (MIME_HANDLER,           mime_handler),           \
+    call (PERMISSION_HANDLER,     permission_handler),     \
+    call (DOWNLOAD_HANDLER,       download_handler),       \
+    call (FILE_CHOOSER_HANDLER,   file_chooser_handler),   \
+    call (AUTHENTICATION_HANDLER, authentication_handler)
+
+typedef enum {
+#define variable_id_enum(id, name) UZBL_VARIABLE_##id
+
+    UZBL_VARIABLE_IDS (variable_id_enum),
+
+#undef variable_id_enum
+
+    /* Must be last entry. */
+    UZBL_VARIABLE_LAST
+} UzblVariableId;
+
+gchar *
+uzbl_variables_get_string_id (UzblVariableId id);
+int
+uzbl_variables_get_int_id (UzblVariableId id);
+
+/* Called after the variable is changed. */
+typedef void (*UzblVariableNotify)(UzblVariableId id, gpointer data);
+
+void
+uzbl_variables_connect (UzblVariableId id, UzblVariableNotify callback, gpointer data);
+
 gchar *
 uzbl_variables_get_string (const gchar *name);
 int
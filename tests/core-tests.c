@@ -1,9 +1,13 @@
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include "../src/uzbl-core.h"
 
 #include "../src/setup.h"
 #include "../src/commands.h"
+#include "../src/events.h"
+#include "../src/filter.h"
+#include "../src/variables.h"
 
 UzblCore uzbl;
 
@@ -55,17 +59,138 @@ test_parse_escaped_at ()
     g_assert_cmpstr (g_array_index (argv, gchar*, 0), ==, "@");
 }
 
+static void
+test_event_mask ()
+{
+    UzblEventMask mask;
+    UzblEventType type;
+
+    uzbl_events_mask_clear (&mask);
+    g_assert_false (uzbl_events_mask_has (&mask, KEY_PRESS));
+
+    g_assert_true (uzbl_events_lookup ("TITLE_CHANGED", &type));
+    g_assert_cmpint (TITLE_CHANGED, ==, type);
+    uzbl_events_mask_add (&mask, type);
+    g_assert_true (uzbl_events_mask_has (&mask, TITLE_CHANGED));
+    g_assert_false (uzbl_events_mask_has (&mask, VARIABLE_SET));
+
+    uzbl_events_mask_fill (&mask);
+    g_assert_true (uzbl_events_mask_has (&mask, CLOSE_NOTIFICATION));
+    g_assert_false (uzbl_events_mask_has (&mask, LAST_EVENT));
+    g_assert_false (uzbl_events_lookup ("NO_SUCH_EVENT", &type));
+}
+
+static void
+test_expand_template ()
+{
+    UzblTemplate *tmpl = NULL;
+    UzblTemplate *compiled;
+    gchar *out;
+
+    out = uzbl_variables_expand_template (&tmpl, "plain \\@text");
+    g_assert_cmpstr (out, ==, "plain \\@text");
+    g_free (out);
+    compiled = tmpl;
+
+    /* The same format reuses the compiled template. */
+    out = uzbl_variables_expand_template (&tmpl, "plain \\@text");
+    g_assert_cmpstr (out, ==, "plain \\@text");
+    g_assert_true (compiled == tmpl);
+    g_free (out);
+
+    /* A changed format is compiled again. */
+    out = uzbl_variables_expand_template (&tmpl, "other");
+    g_assert_cmpstr (out, ==, "other");
+    g_free (out);
+
+    uzbl_variables_template_free (tmpl);
+}
+
+static void
+test_filter_check ()
+{
+    gchar *rewrite = NULL;
+
+    g_assert_true (uzbl_filter_add ("block host example.com"));
+    g_assert_true (uzbl_filter_add ("block url /ads/"));
+    g_assert_true (uzbl_filter_add ("allow url /ads/ok"));
+    g_assert_true (uzbl_filter_add ("rewrite regex ^http://(.*)$ https://\\1"));
+    g_assert_false (uzbl_filter_add ("block nothing"));
+
+    g_assert_cmpint (UZBL_FILTER_BLOCK, ==, uzbl_filter_check ("https://cdn.Example.com:8080/", &rewrite));
+    g_assert_cmpstr (rewrite, ==, "about:blank");
+    g_free (rewrite);
+    rewrite = NULL;
+
+    g_assert_cmpint (UZBL_FILTER_PASS, ==, uzbl_filter_check ("https://notexample.com/", &rewrite));
+    g_assert_cmpint (UZBL_FILTER_BLOCK, ==, uzbl_filter_check ("https://uzbl.org/ads/a.png", &rewrite));
+    g_free (rewrite);
+    rewrite = NULL;
+
+    g_assert_cmpint (UZBL_FILTER_ALLOW, ==, uzbl_filter_check ("https://uzbl.org/ads/ok.png", &rewrite));
+    g_assert_null (rewrite);
+
+    g_assert_cmpint (UZBL_FILTER_REWRITE, ==, uzbl_filter_check ("http://uzbl.org/", &rewrite));
+    g_assert_cmpstr (rewrite, ==, "https://uzbl.org/");
+    g_free (rewrite);
+
+    uzbl_filter_clear ();
+}
+
+static void
+test_filter_map ()
+{
+    gchar *source = g_build_filename (g_get_tmp_dir (), "uzbl-test-hosts", NULL);
+    gchar *path = g_build_filename (g_get_tmp_dir (), "uzbl-test-hosts.map", NULL);
+    gchar *rewrite = NULL;
+
+    g_assert_true (g_file_set_contents (source,
+        "# comment\n"
+        "0.0.0.0 ads.example.com\n"
+        "example.com\n"
+        "tracker-example.net\n"
+        "ads.example.com\n", -1, NULL));
+
+    g_assert_true (uzbl_filter_compile (source, path));
+    g_assert_true (uzbl_filter_map ("block", path));
+    g_assert_false (uzbl_filter_map ("block", source));
+
+    g_assert_cmpint (UZBL_FILTER_BLOCK, ==, uzbl_filter_check ("https://a.b.example.com/", &rewrite));
+    g_free (rewrite);
+    rewrite = NULL;
+
+    g_assert_cmpint (UZBL_FILTER_BLOCK, ==, uzbl_filter_check ("https://tracker-example.net/", &rewrite));
+    g_free (rewrite);
+    rewrite = NULL;
+
+    g_assert_cmpint (UZBL_FILTER_PASS, ==, uzbl_filter_check ("https://example.net/", &rewrite));
+    g_assert_cmpint (UZBL_FILTER_PASS, ==, uzbl_filter_check ("https://my-example.com/", &rewrite));
+
+    uzbl_filter_clear ();
+
+    g_unlink (source);
+    g_unlink (path);
+    g_free (source);
+    g_free (path);
+}
+
 int
 main (int argc, char *argv[])
 {
     g_test_init (&argc, &argv, NULL);
 
+    uzbl_variables_init ();
     uzbl_commands_init ();
+    uzbl_filter_init ();
 
     g_test_add_func ("/uzbl/commands/parse_simple", test_parse_simple);
     g_test_add_func ("/uzbl/commands/parse_quoted", test_parse_quoted);
     g_test_add_func ("/uzbl/commands/parse_extra_whitespace", test_parse_extra_whitespace);
     g_test_add_func ("/uzbl/commands/parse_escaped_at", test_parse_escaped_at);
+    g_test_add_func ("/uzbl/events/mask", test_event_mask);
+    g_test_add_func ("/uzbl/variables/expand_template", test_expand_template);
+    g_test_add_func ("/uzbl/filter/check", test_filter_check);
+    g_test_add_func ("/uzbl/filter/map", test_filter_map);
 
     return g_test_run ();
 }
@@ -2,9 +2,15 @@
 # vi: set et ts=4:
 
 import six
+import struct
 import unittest
 from mock import Mock
-from uzbl.core import Uzbl
+from uzbl.core import Uzbl, decode_frame, TYPE_INT, TYPE_STR, TYPE_STR_ARRAY
+
+
+def pack_string(s):
+    s = s.encode('utf-8')
+    return struct.pack('>I', len(s)) + s
 
 
 class TestUzbl(unittest.TestCase):
@@ -87,3 +93,32 @@ def __init__(self, uzbl): pass
         for t in (FooPlugin, BarPlugin):
             self.assertIn(t, u.plugins)
             self.assertTrue(isinstance(u.plugins[t], t))
+
+    def test_decode_frame(self):
+        frame = (pack_string('EVENT') + pack_string('spam') +
+                 pack_string('FOO') + struct.pack('>I', 3) +
+                 struct.pack('>Bi', TYPE_INT, -1) +
+                 struct.pack('>B', TYPE_STR) + pack_string("it's") +
+                 struct.pack('>BI', TYPE_STR_ARRAY, 2) +
+                 pack_string('a') + pack_string('b c'))
+        self.assertEqual(decode_frame(frame), ('EVENT', 'spam', 'FOO', [
+            (TYPE_INT, -1),
+            (TYPE_STR, "it's"),
+            (TYPE_STR_ARRAY, ['a', 'b c'])]))
+
+    def test_decode_truncated_frame(self):
+        with self.assertRaises(ValueError):
+            decode_frame(pack_string('EVENT')[:-1])
+
+    def test_parse_frame_sends_event(self):
+        handler = Mock()
+        self.uzbl.connect('FOO', handler)
+        frame = (pack_string('EVENT') + pack_string('spam') +
+                 pack_string('FOO') + struct.pack('>I', 1) +
+                 struct.pack('>B', TYPE_STR) + pack_string("it's"))
+        self.uzbl.parse_frame(frame)
+        handler.assert_called_once_with(("it's",))
+
+    def test_parse_framing_switch(self):
+        self.uzbl.parse_msg('FRAMING binary')
+        self.proto.set_framing.assert_called_once_with('binary')
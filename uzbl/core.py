@@ -1,7 +1,112 @@
 import time
+import struct
 import logging
 from collections import defaultdict
 
+from uzbl.arguments import Arguments, splitquoted
+
+# Field type codes of binary frames (TYPE_* in src/type.h).
+TYPE_INT = 1
+TYPE_STR = 2
+TYPE_DOUBLE = 3
+TYPE_ULL = 4
+TYPE_NAME = 5
+TYPE_FORMATTEDSTR = 6
+TYPE_STR_ARRAY = 7
+
+
+def decode_frame(frame):
+    '''Decode a binary frame (without its length prefix) into a
+    `(directive, name, event, fields)` tuple where `fields` is a list of
+    `(type, value)` pairs.'''
+
+    frame = bytes(frame)
+    offset = [0]
+
+    def take(fmt):
+        value = struct.unpack_from(fmt, frame, offset[0])
+        offset[0] += struct.calcsize(fmt)
+        return value[0]
+
+    def take_string():
+        length = take('>I')
+        start = offset[0]
+        offset[0] += length
+        if offset[0] > len(frame):
+            raise ValueError('truncated frame')
+        return frame[start:offset[0]].decode('utf-8')
+
+    try:
+        directive, name, event = take_string(), take_string(), take_string()
+        fields = []
+        for i in range(take('>I')):
+            kind = take('>B')
+            if kind == TYPE_INT:
+                value = take('>i')
+            elif kind == TYPE_ULL:
+                value = take('>Q')
+            elif kind == TYPE_DOUBLE:
+                value = take('>d')
+            elif kind in (TYPE_STR, TYPE_NAME, TYPE_FORMATTEDSTR):
+                value = take_string()
+            elif kind == TYPE_STR_ARRAY:
+                value = [take_string() for j in range(take('>I'))]
+            else:
+                raise ValueError('unknown field type %d' % kind)
+            fields.append((kind, value))
+    except struct.error:
+        raise ValueError('truncated frame')
+
+    return directive, name, event, fields
+
+
+def _quote(s):
+    return "'%s'" % (
+        s.replace('\\', '\\\\').replace("'", "\\'").replace('\n', '\\n'))
+
+
+def format_fields(fields):
+    '''Format decoded frame fields the way they appear in text messages.'''
+
+    args = []
+    for kind, value in fields:
+        if kind == TYPE_STR:
+            args.append(_quote(value))
+        elif kind == TYPE_STR_ARRAY:
+            args.append(' '.join(_quote(v) for v in value))
+        elif kind == TYPE_DOUBLE:
+            args.append('%.2g' % value)
+        else:
+            args.append(str(value))
+    return ' '.join(args)
+
+
+def frame_arguments(fields):
+    '''Turn decoded frame fields into event handler arguments without going
+    through the quoting of text messages.
+
+    Fields which are never quoted give the same string as the text message.
+    Otherwise the arguments are handed over already split, as `Arguments`,
+    which `splitquoted` passes through as is.'''
+
+    if not any(kind in (TYPE_STR, TYPE_STR_ARRAY) for kind, value in fields):
+        return format_fields(fields)
+
+    args = []
+    for kind, value in fields:
+        if kind == TYPE_STR:
+            args.append(value)
+        elif kind == TYPE_STR_ARRAY:
+            args.extend(value)
+        elif kind == TYPE_DOUBLE:
+            args.append('%.2g' % value)
+        elif kind == TYPE_FORMATTEDSTR:
+            # Raw text; split it as the text message would be.
+            args.extend(splitquoted(value))
+        else:
+            args.append(str(value))
+    return Arguments(tuple(args))
+
 
 class Uzbl(object):
 
@@ -72,27 +177,51 @@ def parse_msg(self, line):
         # Split by spaces (and fill missing with nulls)
         elems = (line.split(' ', 3) + [''] * 3)[:4]
 
+        self.dispatch(line, *elems)
+
+    def parse_frame(self, frame):
+        '''Parse an incoming binary frame from a uzbl instance. Frames are
+        handled like the equivalent text message, but their fields reach the
+        handlers without being quoted and split again.'''
+
+        directive, name, event, fields = decode_frame(frame)
+
+        # Frames without a directive carry a text message.
+        if not directive:
+            self.parse_msg(fields[0][1] if fields else '')
+            return
+
+        self.dispatch(frame, directive, name, event, frame_arguments(fields))
+
+    def dispatch(self, msg, directive, name, event, args):
+        '''Hand a parsed message to the request or event handlers. `msg` is
+        the original message, used for logging.'''
+
         handler = None
         kargs = {}
 
+        # The instance changed how messages are delimited.
+        if directive == 'FRAMING':
+            self.proto.set_framing(name)
+            return
+
         # Ignore non-event messages.
-        if elems[0].startswith('REQUEST-'):
+        if directive.startswith('REQUEST-'):
             handler = self.request
-            kargs['cookie'] = elems[0][8:]
-        elif elems[0] == 'EVENT':
+            kargs['cookie'] = directive[8:]
+        elif directive == 'EVENT':
             handler = self.event
 
         if handler is None:
-            if line:
-                self.logger.info('unrecognized message: %r', line)
+            if msg:
+                self.logger.info('unrecognized message: %r', msg)
                 if self.print_events:
-                    self.logger.debug(('--- %s' % line))
+                    self.logger.debug(('--- %s' % msg))
             return
 
         # Check event string elements
-        (name, event, args) = elems[1:]
         if not name or not event:
-            raise ValueError("event string missing elements: %r" % (line,))
+            raise ValueError("event string missing elements: %r" % (msg,))
         if not self.name:
             self.name = name
             self.logger = logging.getLogger('uzbl-instance%s' % name)
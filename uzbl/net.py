@@ -4,6 +4,7 @@
 import asynchat
 import six
 import socket
+import struct
 import os
 import logging
 
@@ -96,12 +97,23 @@ def __init__(self, socket, target=None):
         self.socket = socket
         self.target = target
         self.buffer = bytearray()
+        self.binary = False
         self.set_terminator(b'\n')
 
+    def set_framing(self, framing):
+        ''' Switch between newline delimited and length-prefixed messages '''
+        self.binary = (framing == 'binary')
+        self.frame_length = None
+        self.set_terminator(4 if self.binary else b'\n')
+
     def collect_incoming_data(self, data):
         self.buffer += data
 
     def found_terminator(self):
+        if self.binary:
+            self.found_frame()
+            return
+
         if six.PY3:
             val = self.buffer.decode('utf-8')
         else:
@@ -112,5 +124,23 @@ def found_terminator(self):
         except ValueError as e:
             logger.warning("invalid message %s", e)
 
+    def found_frame(self):
+        data = bytes(self.buffer)
+        del self.buffer[:]
+
+        if self.frame_length is None:
+            self.frame_length = struct.unpack('>I', data)[0]
+            if self.frame_length:
+                self.set_terminator(self.frame_length)
+                return
+            data = b''
+
+        self.frame_length = None
+        self.set_terminator(4)
+        try:
+            self.target.parse_frame(data)
+        except ValueError as e:
+            logger.warning("invalid frame %s", e)
+
     def handle_error(self):
         raise
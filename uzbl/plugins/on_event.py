@@ -20,7 +20,7 @@
 import fnmatch
 from functools import partial
 
-from uzbl.arguments import splitquoted
+from uzbl.arguments import Arguments, splitquoted
 from .cmd_expand import send_user_command
 from uzbl.ext import PerInstancePlugin
 
@@ -51,7 +51,7 @@ def event_handler(self, *args, **kargs):
 
         # Could be connected to a EM internal event that can use anything as
         # arguments
-        if len(args) == 1 and isinstance(args[0], str):
+        if len(args) == 1 and isinstance(args[0], (str, Arguments)):
             args = splitquoted(args[0])
 
         event = kargs['on_event']